@@ -0,0 +1,355 @@
+/**
+ * @file benchmark.c
+ * @brief Microbenchmarks for the hot paths of the PWM Tone library.
+ * Measures the cycles spent per call in the public functions and in the alarm
+ * and interrupt callbacks, and reports min/median/max for each operation,
+ * first as a table and then as CSV for tracking over time.
+ * Build once with -DPWM_TONE_PWM_ONLY=ON and once without to compare
+ * compile-time and run-time backend dispatch.
+ * With PWM_TONE_HOST=1 (see host/CMakeLists.txt), the benchmark runs on a
+ * computer against the simulated SDK, measures nanoseconds instead of
+ * cycles, and also writes the CSV to BENCH_CSV_PATH.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pico/stdlib.h>
+#include "hardware/clocks.h"
+#include "pwm-tone.h"
+
+#ifndef PWM_TONE_HOST
+#define PWM_TONE_HOST 0
+#endif
+
+#if PWM_TONE_HOST
+#include <time.h>
+#define BENCH_PLATFORM  "host"
+#define BENCH_UNIT      "ns"
+#else
+#include "hardware/structs/systick.h"
+#define BENCH_PLATFORM  "rp2040"
+#define BENCH_UNIT      "cycles"
+#endif
+
+/**
+ * @def PIEZO_PIN
+ * @brief GPIO pin number for the piezo buzzer or speaker.
+ */
+#define PIEZO_PIN       0
+
+/**
+ * @def NOISE_PIN
+ * @brief GPIO pin number for the noise generator. Must be on a different PWM slice.
+ */
+#define NOISE_PIN       2
+
+/**
+ * @def SAMPLES
+ * @brief Number of samples collected per operation.
+ */
+#define SAMPLES         256
+
+/**
+ * @brief Samples collected for one operation.
+ */
+typedef struct bench_t {
+    const char *name;
+    uint16_t count;
+    uint32_t cycles[SAMPLES];
+} bench_t;
+
+/**
+ * @brief Operations measured by calling them directly.
+ */
+enum {
+    BENCH_TONE = TONE_PROFILE_COUNT,
+    BENCH_TONE_PWM_ON,
+    BENCH_MELODY_STEP,
+    BENCH_MELODY_CODE_STEP,
+    BENCH_COUNT,
+};
+
+/**
+ * @brief Samples of every operation, indexed by TONE_PROFILE_* and BENCH_*.
+ */
+static bench_t benches[BENCH_COUNT] = {
+    [TONE_PROFILE_TONE_COMPLETE] = {"_tone_complete"},
+    [TONE_PROFILE_NOTE_COMPLETE] = {"_melody_note_complete"},
+    [TONE_PROFILE_REST_COMPLETE] = {"_rest_complete"},
+    [TONE_PROFILE_ARPEGGIO_STEP] = {"_arpeggio_step"},
+    [TONE_PROFILE_NOISE_SAMPLE] = {"noise_sample"},
+    [TONE_PROFILE_MARKER] = {"marker_dispatch"},
+    [BENCH_TONE] = {"tone"},
+    [BENCH_TONE_PWM_ON] = {"_tone_pwm_on"},
+    [BENCH_MELODY_STEP] = {"_melody_step"},
+    [BENCH_MELODY_CODE_STEP] = {"_melody_step (code)"},
+};
+
+/**
+ * @brief Start time of the callback being profiled, per operation.
+ */
+static uint32_t profile_start[TONE_PROFILE_COUNT];
+
+/**
+ * @brief Create instances of the tone generators.
+ */
+tonegenerator_t generator;
+tonegenerator_t noise;
+
+/**
+ * @brief A melody exercising notes, rests, chords and markers.
+ */
+note_t bench_melody[] = {
+    MARKER_AT(1),
+    {NOTE_C5, 64},
+    {REST, 64},
+    {CHORD, 3}, {NOTE_C5, 8}, {NOTE_E5, 8}, {NOTE_G5, 8},
+    {MELODY_END, 0},
+};
+
+/**
+ * @brief The same notes as bytecode, through a repeated block and a subroutine.
+ */
+static const uint8_t bench_code[] = {
+    MELODY_OP_REPEAT, 4, MELODY_OP_CALL, 7, 0, MELODY_OP_LOOP, MELODY_OP_END,
+    72, 64, MELODY_OP_REST, 64, MELODY_OP_RET, // Subroutine: C5, rest
+};
+
+#if PWM_TONE_HOST
+/**
+ * @brief On the host, the monotonic clock is used instead of SysTick.
+ */
+static void cycles_init(void){
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Current time (in ns, wrapping at 32 bits).
+ */
+static inline uint32_t cycles_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+/**
+ * @brief Computes the time elapsed between two clock values.
+ * @param start Clock value at the start.
+ * @param end Clock value at the end.
+ * @return Elapsed time (in ns).
+ */
+static inline uint32_t cycles_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+#else
+/**
+ * @brief Starts SysTick as a free-running 24-bit down counter clocked by the processor.
+ */
+static void cycles_init(void){
+    systick_hw->csr = 0;
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5; // Enable, processor clock
+}
+
+/**
+ * @brief Reads the SysTick counter.
+ * @return Current counter value.
+ */
+static inline uint32_t cycles_now(void){
+    return systick_hw->cvr;
+}
+
+/**
+ * @brief Computes the cycles elapsed between two counter values.
+ * @param start Counter value at the start.
+ * @param end Counter value at the end.
+ * @return Elapsed cycles.
+ */
+static inline uint32_t cycles_elapsed(uint32_t start, uint32_t end){
+    return (start - end) & 0x00FFFFFF;
+}
+#endif
+
+/**
+ * @brief Records a sample for an operation.
+ * @param op Operation.
+ * @param cycles Elapsed cycles.
+ */
+static inline void bench_record(uint8_t op, uint32_t cycles){
+    bench_t *b = &benches[op];
+    if(b->count < SAMPLES) b->cycles[b->count++] = cycles;
+}
+
+/**
+ * @brief Profiling hook called by the library when a callback starts.
+ * @param op Operation (TONE_PROFILE_*).
+ */
+void pwm_tone_profile_begin(uint8_t op){
+    profile_start[op] = cycles_now();
+}
+
+/**
+ * @brief Profiling hook called by the library when a callback ends.
+ * @param op Operation (TONE_PROFILE_*).
+ */
+void pwm_tone_profile_end(uint8_t op){
+    bench_record(op, cycles_elapsed(profile_start[op], cycles_now()));
+}
+
+/**
+ * @brief Comparison function for qsort().
+ */
+static int compare_cycles(const void *a, const void *b){
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Cancels the pending alarms of a generator, so that no callback
+ * runs while _melody_step() is being measured from thread context.
+ * @param gen Pointer to the tone generator structure.
+ */
+static void bench_cancel_alarms(tonegenerator_t *gen){
+    _tone_alarm_cancel(gen->tone_a);
+    _tone_alarm_cancel(gen->melody_a);
+    _tone_alarm_cancel(gen->rest_a);
+    _tone_alarm_cancel(gen->arp_a);
+    gen->tone_a = gen->melody_a = gen->rest_a = gen->arp_a = 0;
+}
+
+/**
+ * @brief Writes the results of all operations as CSV.
+ * @param out Stream to write to.
+ */
+static void bench_write_csv(FILE *out){
+    const char *mode = PWM_TONE_PWM_ONLY ? "pwm_only" : "backend";
+    fprintf(out, "platform,mode,operation,samples,min,median,max,unit\n");
+    for(int op = 0; op < BENCH_COUNT; op++){
+        bench_t *b = &benches[op];
+        if(b->count == 0) continue;
+        fprintf(out, "%s,%s,%s,%u,%lu,%lu,%lu,%s\n", BENCH_PLATFORM, mode, b->name, b->count,
+            (unsigned long) b->cycles[0],
+            (unsigned long) b->cycles[b->count / 2],
+            (unsigned long) b->cycles[b->count - 1],
+            BENCH_UNIT);
+    }
+}
+
+/**
+ * @brief Prints the results of all operations, as a table and as CSV.
+ */
+static void bench_report(void){
+    const char *mode = PWM_TONE_PWM_ONLY ? "pwm_only" : "backend";
+    uint32_t clock = clock_get_hz(clk_sys);
+
+    printf("\npwm_tone_benchmark platform=%s mode=%s clk_sys=%lu unit=%s\n",
+        BENCH_PLATFORM, mode, (unsigned long) clock, BENCH_UNIT);
+    printf("%-24s %8s %8s %8s %8s\n", "operation", "samples", "min", "median", "max");
+    for(int op = 0; op < BENCH_COUNT; op++){
+        bench_t *b = &benches[op];
+        if(b->count == 0) {
+            printf("%-24s %8u %8s %8s %8s\n", b->name, 0, "-", "-", "-");
+            continue;
+        }
+        qsort(b->cycles, b->count, sizeof(uint32_t), compare_cycles);
+        printf("%-24s %8u %8lu %8lu %8lu\n", b->name, b->count,
+            (unsigned long) b->cycles[0],
+            (unsigned long) b->cycles[b->count / 2],
+            (unsigned long) b->cycles[b->count - 1]);
+    }
+
+    printf("\n# csv\n");
+    bench_write_csv(stdout);
+    printf("# end\n");
+
+#ifdef BENCH_CSV_PATH
+    FILE *csv = fopen(BENCH_CSV_PATH, "w");
+    if(csv){
+        bench_write_csv(csv);
+        fclose(csv);
+        printf("CSV written to %s\n", BENCH_CSV_PATH);
+    } else {
+        printf("Could not write %s\n", BENCH_CSV_PATH);
+    }
+#endif
+}
+
+int main() {
+    stdio_init_all();
+    sleep_ms(2000); // Give the host time to open the serial port
+
+    tone_init(&generator, PIEZO_PIN);
+#if !PWM_TONE_PWM_ONLY
+    tone_init_noise(&noise, NOISE_PIN);
+#endif
+    cycles_init();
+
+    /**
+     * @brief Functions called directly, from thread context.
+     */
+    for(int i = 0; i < SAMPLES; i++){
+        float freq = (i & 1) ? NOTE_A4 : NOTE_A5;
+        uint32_t start = cycles_now();
+        _tone_pwm_on(&generator, freq);
+        bench_record(BENCH_TONE_PWM_ON, cycles_elapsed(start, cycles_now()));
+    }
+    stop_tone(&generator);
+
+    for(int i = 0; i < SAMPLES; i++){
+        uint32_t start = cycles_now();
+        tone(&generator, NOTE_A4, 1);
+        bench_record(BENCH_TONE, cycles_elapsed(start, cycles_now()));
+        while(generator.playing) { tight_loop_contents(); } // Collects _tone_complete
+    }
+
+    set_rest_duration(0);
+    melody(&generator, bench_melody, -1);
+    bench_cancel_alarms(&generator);
+    for(int i = 0; i < SAMPLES; i++){
+        uint32_t start = cycles_now();
+        _melody_step(&generator);
+        bench_record(BENCH_MELODY_STEP, cycles_elapsed(start, cycles_now()));
+        bench_cancel_alarms(&generator); // Each step schedules the end of its note
+    }
+    stop_melody(&generator);
+
+    melody_code(&generator, bench_code, sizeof(bench_code), 0, -1);
+    bench_cancel_alarms(&generator);
+    for(int i = 0; i < SAMPLES; i++){
+        uint32_t start = cycles_now();
+        _melody_step(&generator);
+        bench_record(BENCH_MELODY_CODE_STEP, cycles_elapsed(start, cycles_now()));
+        bench_cancel_alarms(&generator);
+    }
+    stop_melody(&generator);
+
+    /**
+     * @brief Alarm and interrupt callbacks, collected by the profiling hooks
+     * while melodies play.
+     */
+    set_rest_duration(1);
+    set_tempo(240);
+    melody(&generator, bench_melody, -1);
+#if !PWM_TONE_PWM_ONLY
+    melody(&noise, bench_melody, -1);
+#endif
+    sleep_ms(5000);
+    stop_melody(&generator);
+#if !PWM_TONE_PWM_ONLY
+    stop_melody(&noise);
+#endif
+
+    bench_report();
+
+#if PWM_TONE_HOST
+    return 0;
+#else
+    while (true) {
+        tight_loop_contents();
+    }
+#endif
+}
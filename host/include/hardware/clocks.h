@@ -0,0 +1,19 @@
+/**
+ * @file clocks.h
+ * @brief Host replacement for hardware/clocks.h. The system clock runs at 125 MHz.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_HARDWARE_CLOCKS_H
+#define HOST_HARDWARE_CLOCKS_H
+
+#include <pico/stdlib.h>
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#endif // HOST_HARDWARE_CLOCKS_H
@@ -0,0 +1,21 @@
+/**
+ * @file irq.h
+ * @brief Host replacement for hardware/irq.h. Only PWM_IRQ_WRAP is simulated.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_HARDWARE_IRQ_H
+#define HOST_HARDWARE_IRQ_H
+
+#include <pico/stdlib.h>
+
+#define PWM_IRQ_WRAP 4
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+typedef void (*irq_handler_t)(void);
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority);
+void irq_set_enabled(uint num, bool enabled);
+
+#endif // HOST_HARDWARE_IRQ_H
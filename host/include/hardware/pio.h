@@ -0,0 +1,59 @@
+/**
+ * @file pio.h
+ * @brief Host replacement for hardware/pio.h, backed by a cycle model of the
+ * PIO state machines (see pio-model.c).
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_HARDWARE_PIO_H
+#define HOST_HARDWARE_PIO_H
+
+#include <pico/stdlib.h>
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_INSTRUCTION_COUNT 32
+
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+typedef struct pio_sm_config {
+    uint8_t wrap_target;
+    uint8_t wrap;
+    uint8_t sideset_bit_count; /**< Side-set bits, including the enable bit if optional. */
+    bool sideset_optional;
+    uint8_t sideset_base;
+} pio_sm_config;
+
+PIO pio_get_instance(uint instance);
+bool pio_can_add_program(PIO pio, const pio_program_t *program);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_gpio_init(PIO pio, uint pin);
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+
+static inline uint pio_encode_jmp(uint addr){
+    return addr & 0x1F;
+}
+
+#endif // HOST_HARDWARE_PIO_H
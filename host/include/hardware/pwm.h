@@ -0,0 +1,99 @@
+/**
+ * @file pwm.h
+ * @brief Host replacement for hardware/pwm.h. The functions write a simulated
+ * copy of the PWM registers, with the same layout as on the RP2040.
+ * Slices with their wrap interrupt enabled raise PWM_IRQ_WRAP as simulated time passes.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_HARDWARE_PWM_H
+#define HOST_HARDWARE_PWM_H
+
+#include <pico/stdlib.h>
+
+#define NUM_PWM_SLICES 8
+
+#define PWM_CH0_CSR_EN_BITS 0x00000001u
+#define PWM_CH0_CSR_A_INV_BITS 0x00000004u
+#define PWM_CH0_CSR_B_INV_BITS 0x00000008u
+
+enum pwm_chan {
+    PWM_CHAN_A = 0,
+    PWM_CHAN_B = 1,
+};
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t div;
+    volatile uint32_t ctr;
+    volatile uint32_t cc;
+    volatile uint32_t top;
+} pwm_slice_hw_t;
+
+typedef struct {
+    pwm_slice_hw_t slice[NUM_PWM_SLICES];
+    volatile uint32_t en;
+    volatile uint32_t intr;
+    volatile uint32_t inte;
+    volatile uint32_t intf;
+    volatile uint32_t ints;
+} pwm_hw_t;
+
+extern pwm_hw_t host_pwm_hw;
+#define pwm_hw (&host_pwm_hw)
+
+static inline uint pwm_gpio_to_slice_num(uint gpio){
+    return (gpio >> 1u) & 7u;
+}
+
+static inline uint pwm_gpio_to_channel(uint gpio){
+    return gpio & 1u;
+}
+
+static inline void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level){
+    uint shift = chan ? 16 : 0;
+    pwm_hw->slice[slice_num].cc = (pwm_hw->slice[slice_num].cc & ~(0xFFFFu << shift)) | ((uint32_t) level << shift);
+}
+
+static inline void pwm_set_gpio_level(uint gpio, uint16_t level){
+    pwm_set_chan_level(pwm_gpio_to_slice_num(gpio), pwm_gpio_to_channel(gpio), level);
+}
+
+static inline void pwm_set_wrap(uint slice_num, uint16_t wrap){
+    pwm_hw->slice[slice_num].top = wrap;
+}
+
+static inline void pwm_set_output_polarity(uint slice_num, bool a, bool b){
+    uint32_t csr = pwm_hw->slice[slice_num].csr & ~(PWM_CH0_CSR_A_INV_BITS | PWM_CH0_CSR_B_INV_BITS);
+    if(a) csr |= PWM_CH0_CSR_A_INV_BITS;
+    if(b) csr |= PWM_CH0_CSR_B_INV_BITS;
+    pwm_hw->slice[slice_num].csr = csr;
+}
+
+static inline void pwm_set_clkdiv(uint slice_num, float divider){
+    pwm_hw->slice[slice_num].div = (uint32_t)(divider * 16.0f);
+}
+
+/**
+ * @brief Starts or stops a slice. Defined in sdk.c, which times the wrap interrupts.
+ */
+void pwm_set_enabled(uint slice_num, bool enabled);
+
+static inline void pwm_set_irq_enabled(uint slice_num, bool enabled){
+    if(enabled){
+        pwm_hw->inte |= 1u << slice_num;
+    } else {
+        pwm_hw->inte &= ~(1u << slice_num);
+    }
+}
+
+static inline void pwm_clear_irq(uint slice_num){
+    pwm_hw->intr &= ~(1u << slice_num);
+}
+
+static inline uint32_t pwm_get_irq_status_mask(void){
+    return pwm_hw->intr & pwm_hw->inte;
+}
+
+#endif // HOST_HARDWARE_PWM_H
@@ -0,0 +1,25 @@
+/**
+ * @file sync.h
+ * @brief Host replacement for hardware/sync.h. Simulated interrupts only run
+ * from the main thread, when time moves, so no locking is needed.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+#include <pico/stdlib.h>
+
+static inline uint32_t save_and_disable_interrupts(void){
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status){
+}
+
+static inline void __dmb(void){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif // HOST_HARDWARE_SYNC_H
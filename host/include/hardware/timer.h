@@ -0,0 +1,24 @@
+/**
+ * @file timer.h
+ * @brief Host replacement for hardware/timer.h, with simulated hardware alarms.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_HARDWARE_TIMER_H
+#define HOST_HARDWARE_TIMER_H
+
+#include <pico/stdlib.h>
+
+#define NUM_TIMERS 4
+
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+void hardware_alarm_claim(uint alarm_num);
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+void hardware_alarm_cancel(uint alarm_num);
+void hardware_alarm_force_irq(uint alarm_num);
+
+#endif // HOST_HARDWARE_TIMER_H
@@ -0,0 +1,59 @@
+/**
+ * @file stdlib.h
+ * @brief Host replacement for the parts of pico/stdlib.h used by the PWM Tone library.
+ * Time is simulated: it only moves forward in sleep_ms(), sleep_us() and
+ * tight_loop_contents(), which run the alarms that fall due on the way.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+#define __noinline __attribute__((noinline))
+#define __force_inline inline __attribute__((always_inline))
+
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+typedef uint64_t absolute_time_t;
+
+static inline absolute_time_t from_us_since_boot(uint64_t us){
+    return us;
+}
+
+uint64_t time_us_64(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void tight_loop_contents(void);
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past);
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void *user_data, bool fire_if_past);
+bool cancel_alarm(alarm_id_t id);
+
+enum gpio_function {
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_PIO1 = 7,
+};
+
+void gpio_init(uint gpio);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+
+bool stdio_init_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_PICO_STDLIB_H
@@ -0,0 +1,50 @@
+/**
+ * @file pwm-tone.pio.h
+ * @brief pwm-tone.pio, assembled by hand for host builds, in the layout pioasm generates.
+ * Used when pioasm is not available. The host tests run these instruction words,
+ * and test-pio-source.c fails if they no longer match pwm-tone.pio.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_PWM_TONE_PIO_H
+#define HOST_PWM_TONE_PIO_H
+
+#include "hardware/pio.h"
+
+#define pwm_tone_wrap_target 0
+#define pwm_tone_wrap 5
+
+static const uint16_t pwm_tone_program_instructions[] = {
+            //     .wrap_target
+    0x9080, //  0: pull   noblock         side 0
+    0xa027, //  1: mov    x, osr
+    0xba41, //  2: mov    y, x            side 1 [2]
+    0x0083, //  3: jmp    y--, 3
+    0xb041, //  4: mov    y, x            side 0
+    0x0085, //  5: jmp    y--, 5
+            //     .wrap
+};
+
+static const struct pio_program pwm_tone_program = {
+    .instructions = pwm_tone_program_instructions,
+    .length = 6,
+    .origin = -1,
+};
+
+static inline pio_sm_config pwm_tone_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + pwm_tone_wrap_target, offset + pwm_tone_wrap);
+    sm_config_set_sideset(&c, 2, true, false);
+    return c;
+}
+
+static inline void pwm_tone_program_init(PIO pio, uint sm, uint offset, uint pin) {
+    pio_gpio_init(pio, pin);
+    pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, true);
+    pio_sm_config c = pwm_tone_program_get_default_config(offset);
+    sm_config_set_sideset_pins(&c, pin);
+    pio_sm_init(pio, sm, offset, &c);
+}
+
+#endif // HOST_PWM_TONE_PIO_H
@@ -0,0 +1,317 @@
+/**
+ * @file pio-model.c
+ * @brief Cycle model of the PIO state machines, for host tests.
+ * Implements the instructions used by pwm-tone.pio (JMP, MOV and PULL, with
+ * optional side-set and delays) with the timing of the RP2040 datasheet:
+ * every instruction takes one cycle, plus its delay.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pio-model.h"
+
+/**
+ * @def PIO_FIFO_DEPTH
+ * @brief Depth of the TX FIFO (the RX FIFO is not modelled).
+ */
+#define PIO_FIFO_DEPTH 4
+
+/**
+ * @brief State of one state machine.
+ */
+typedef struct pio_model_sm_t {
+    bool enabled;
+    uint8_t pc;
+    uint32_t x, y, osr;
+    uint32_t fifo[PIO_FIFO_DEPTH];
+    uint8_t fifo_level;
+    uint8_t delay; /**< Delay cycles left after the last instruction. */
+    pio_sm_config config;
+} pio_model_sm_t;
+
+/**
+ * @brief State of one PIO block.
+ */
+struct pio_hw {
+    uint16_t instr_mem[PIO_INSTRUCTION_COUNT];
+    uint32_t used_mask; /**< Instruction memory in use. */
+    uint8_t claimed_sm; /**< State machines claimed. */
+    pio_model_sm_t sm[NUM_PIO_STATE_MACHINES];
+};
+
+static pio_hw_t pio_blocks[NUM_PIOS];
+
+/**
+ * @brief Levels of the GPIO pins driven by PIO.
+ */
+static uint32_t pio_pins;
+
+/**
+ * @brief Stops the test on something the model cannot run.
+ * @param message Reason.
+ * @param instr Instruction word.
+ */
+static void _model_fail(const char *message, uint instr){
+    fprintf(stderr, "pio-model: %s (instruction 0x%04x)\n", message, instr);
+    abort();
+}
+
+/**
+ * @brief Finds where a program fits in instruction memory, from the top as the SDK does.
+ * @param pio PIO block.
+ * @param program Program to load.
+ * @return Offset, or -1 if it does not fit.
+ */
+static int _model_find_offset(PIO pio, const pio_program_t *program){
+    uint32_t mask = (1u << program->length) - 1;
+    if(program->origin >= 0){
+        return (pio->used_mask & (mask << program->origin)) ? -1 : program->origin;
+    }
+    for(int offset = PIO_INSTRUCTION_COUNT - program->length; offset >= 0; offset--){
+        if(!(pio->used_mask & (mask << offset))) return offset;
+    }
+    return -1;
+}
+
+/**
+ * @brief Reads a source operand of MOV.
+ * @param sm State machine.
+ * @param source Source field.
+ * @param instr Instruction word.
+ * @return Operand value.
+ */
+static uint32_t _model_mov_source(pio_model_sm_t *sm, uint source, uint instr){
+    switch(source){
+    case 1: return sm->x;
+    case 2: return sm->y;
+    case 3: return 0; // NULL
+    case 7: return sm->osr;
+    }
+    _model_fail("unsupported MOV source", instr);
+    return 0;
+}
+
+/**
+ * @brief Executes one instruction.
+ * @param sm State machine.
+ * @param instr Instruction word.
+ * @return false if the instruction stalls.
+ */
+static bool _model_execute(pio_model_sm_t *sm, uint instr){
+    bool jumped = false;
+    switch(instr >> 13){
+    case 0: { // JMP
+        uint condition = (instr >> 5) & 7;
+        bool take;
+        switch(condition){
+        case 0: take = true; break;
+        case 1: take = sm->x == 0; break;
+        case 2: take = sm->x-- != 0; break;
+        case 3: take = sm->y == 0; break;
+        case 4: take = sm->y-- != 0; break;
+        default: _model_fail("unsupported JMP condition", instr); return true;
+        }
+        if(take){
+            sm->pc = instr & 0x1F;
+            jumped = true;
+        }
+        break;
+    }
+    case 4: // PUSH/PULL
+        if(!(instr & 0x80)) _model_fail("PUSH is not modelled", instr);
+        if(instr & 0x40) _model_fail("PULL ifempty is not modelled", instr);
+        if(sm->fifo_level > 0){
+            sm->osr = sm->fifo[0];
+            for(uint i = 1; i < sm->fifo_level; i++) sm->fifo[i - 1] = sm->fifo[i];
+            sm->fifo_level--;
+        } else if(instr & 0x20){
+            return false; // Blocking: stall until data arrives
+        } else {
+            sm->osr = sm->x; // Non-blocking on an empty FIFO copies X
+        }
+        break;
+    case 5: { // MOV
+        if(instr & 0x18) _model_fail("MOV operations are not modelled", instr);
+        uint32_t value = _model_mov_source(sm, instr & 7, instr);
+        switch((instr >> 5) & 7){
+        case 1: sm->x = value; break;
+        case 2: sm->y = value; break;
+        case 7: sm->osr = value; break;
+        default: _model_fail("unsupported MOV destination", instr);
+        }
+        break;
+    }
+    default:
+        _model_fail("unsupported instruction", instr);
+    }
+
+    if(!jumped){
+        sm->pc = sm->pc == sm->config.wrap ? sm->config.wrap_target : (sm->pc + 1) & 0x1F;
+    }
+    return true;
+}
+
+/**
+ * @brief Applies the side-set of an instruction, and returns its delay.
+ * @param sm State machine.
+ * @param instr Instruction word.
+ * @return Delay (in cycles).
+ */
+static uint8_t _model_side_set(pio_model_sm_t *sm, uint instr){
+    uint field = (instr >> 8) & 0x1F;
+    uint bits = sm->config.sideset_bit_count;
+    uint delay_bits = 5 - bits;
+    uint8_t delay = field & ((1u << delay_bits) - 1);
+    if(bits == 0) return delay;
+
+    uint side = field >> delay_bits;
+    uint value_bits = bits;
+    if(sm->config.sideset_optional){
+        value_bits--;
+        if(!(side & (1u << value_bits))) return delay; // No side-set on this instruction
+    }
+    for(uint i = 0; i < value_bits; i++){
+        uint pin = (sm->config.sideset_base + i) & 31;
+        if(side & (1u << i)){
+            pio_pins |= 1u << pin;
+        } else {
+            pio_pins &= ~(1u << pin);
+        }
+    }
+    return delay;
+}
+
+/**
+ * @brief Runs a state machine for one clock cycle.
+ * @param pio PIO block.
+ * @param sm_num State machine number.
+ */
+void pio_model_step(PIO pio, uint sm_num){
+    pio_model_sm_t *sm = &pio->sm[sm_num];
+    if(!sm->enabled) return;
+    if(sm->delay > 0){
+        sm->delay--;
+        return;
+    }
+    uint instr = pio->instr_mem[sm->pc];
+    uint8_t delay = _model_side_set(sm, instr); // Side-set is asserted even while stalled
+    if(_model_execute(sm, instr)) sm->delay = delay;
+}
+
+/**
+ * @brief Reads the level of a GPIO pin driven by PIO.
+ * @param gpio GPIO pin number.
+ * @return Pin level.
+ */
+bool pio_model_gpio_get(uint gpio){
+    return pio_pins & (1u << gpio);
+}
+
+/**
+ * @brief Reads the number of words waiting in the TX FIFO of a state machine.
+ * @param pio PIO block.
+ * @param sm State machine number.
+ * @return Number of words.
+ */
+uint pio_model_tx_level(PIO pio, uint sm){
+    return pio->sm[sm].fifo_level;
+}
+
+/*
+ * hardware/pio.h functions, as documented in the SDK.
+ */
+
+PIO pio_get_instance(uint instance){
+    if(instance >= NUM_PIOS) _model_fail("invalid PIO instance", instance);
+    return &pio_blocks[instance];
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program){
+    return _model_find_offset(pio, program) >= 0;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program){
+    int offset = _model_find_offset(pio, program);
+    if(offset < 0) _model_fail("no program space", 0);
+    for(uint i = 0; i < program->length; i++){
+        uint16_t instr = program->instructions[i];
+        // JMP targets are relocated, as by the SDK
+        pio->instr_mem[offset + i] = (instr & 0xE000) == 0 ? instr + offset : instr;
+    }
+    pio->used_mask |= ((1u << program->length) - 1) << offset;
+    return offset;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required){
+    for(int sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++){
+        if(!(pio->claimed_sm & (1u << sm))){
+            pio->claimed_sm |= 1u << sm;
+            return sm;
+        }
+    }
+    if(required) _model_fail("no free state machine", 0);
+    return -1;
+}
+
+void pio_gpio_init(PIO pio, uint pin){
+}
+
+pio_sm_config pio_get_default_sm_config(void){
+    pio_sm_config c = {0};
+    c.wrap = 31;
+    return c;
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap){
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs){
+    if(pindirs) _model_fail("side-set pindirs are not modelled", 0);
+    c->sideset_bit_count = bit_count;
+    c->sideset_optional = optional;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base){
+    c->sideset_base = sideset_base;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config){
+    pio_sm_set_enabled(pio, sm, false);
+    pio->sm[sm].config = *config;
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio->sm[sm].pc = initial_pc;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled){
+    pio->sm[sm].enabled = enabled;
+}
+
+void pio_sm_restart(PIO pio, uint sm){
+    pio->sm[sm].delay = 0;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm){
+    pio->sm[sm].fifo_level = 0;
+}
+
+void pio_sm_put(PIO pio, uint sm_num, uint32_t data){
+    pio_model_sm_t *sm = &pio->sm[sm_num];
+    if(sm->fifo_level == PIO_FIFO_DEPTH) return; // Lost, as on a full FIFO
+    sm->fifo[sm->fifo_level++] = data;
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr){
+    _model_execute(&pio->sm[sm], instr);
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask){
+    pio_pins = (pio_pins & ~pin_mask) | (pin_values & pin_mask);
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out){
+}
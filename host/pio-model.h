@@ -0,0 +1,38 @@
+/**
+ * @file pio-model.h
+ * @brief Cycle model of the PIO state machines, for host tests.
+ * The hardware/pio.h functions load programs into the model and feed its FIFOs,
+ * and the model runs the instructions one clock cycle at a time.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef HOST_PIO_MODEL_H
+#define HOST_PIO_MODEL_H
+
+#include "hardware/pio.h"
+
+/**
+ * @brief Runs a state machine for one clock cycle.
+ * Aborts on instructions that the model does not implement.
+ * @param pio PIO block.
+ * @param sm State machine number.
+ */
+void pio_model_step(PIO pio, uint sm);
+
+/**
+ * @brief Reads the level of a GPIO pin driven by PIO.
+ * @param gpio GPIO pin number.
+ * @return Pin level.
+ */
+bool pio_model_gpio_get(uint gpio);
+
+/**
+ * @brief Reads the number of words waiting in the TX FIFO of a state machine.
+ * @param pio PIO block.
+ * @param sm State machine number.
+ * @return Number of words.
+ */
+uint pio_model_tx_level(PIO pio, uint sm);
+
+#endif // HOST_PIO_MODEL_H
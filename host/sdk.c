@@ -0,0 +1,315 @@
+/**
+ * @file sdk.c
+ * @brief Host replacements for the Pico SDK functions used by the PWM Tone library.
+ * Time is simulated, in nanoseconds. It moves forward in sleep_us(), sleep_ms()
+ * and tight_loop_contents(), which run the alarms, hardware alarms and PWM wrap
+ * interrupts that fall due on the way, in order, as interrupts would.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include <pico/stdlib.h>
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include "hardware/pwm.h"
+#include "hardware/timer.h"
+
+/**
+ * @def HOST_CLOCK_HZ
+ * @brief Simulated system clock (in Hz), the RP2040 default.
+ */
+#define HOST_CLOCK_HZ 125000000u
+
+/**
+ * @def HOST_ALARM_COUNT
+ * @brief Number of alarms that can be pending at once, as in the SDK's default alarm pool.
+ */
+#define HOST_ALARM_COUNT 16
+
+/**
+ * @brief Alarm of the simulated default alarm pool.
+ */
+typedef struct host_alarm_t {
+    bool active;
+    alarm_id_t id;
+    uint64_t target_ns;
+    alarm_callback_t callback;
+    void *user_data;
+} host_alarm_t;
+
+/**
+ * @brief Simulated hardware alarm.
+ */
+typedef struct host_hw_alarm_t {
+    bool claimed;
+    bool armed;
+    uint64_t target_ns;
+    hardware_alarm_callback_t callback;
+} host_hw_alarm_t;
+
+/**
+ * @brief Kinds of events run as time moves.
+ */
+enum {
+    HOST_EVENT_NONE = 0,
+    HOST_EVENT_ALARM,
+    HOST_EVENT_HW_ALARM,
+    HOST_EVENT_PWM_WRAP,
+};
+
+static uint64_t host_time_ns;
+
+static host_alarm_t host_alarms[HOST_ALARM_COUNT];
+static alarm_id_t host_last_id;
+
+static host_hw_alarm_t host_hw_alarms[NUM_TIMERS];
+
+pwm_hw_t host_pwm_hw;
+static uint64_t host_pwm_wrap_ns[NUM_PWM_SLICES]; /**< Time of the next wrap of each running slice. */
+static irq_handler_t host_pwm_handler;
+static bool host_pwm_irq_enabled;
+
+/**
+ * @brief Computes the wrap period of a PWM slice from its divider and wrap registers.
+ * @param slice PWM slice number.
+ * @return Period (in ns).
+ */
+static uint64_t _host_pwm_period_ns(uint slice){
+    uint32_t div = host_pwm_hw.slice[slice].div & 0xFFF;
+    if(div < 16) div += 256 * 16; // An integer part of 0 divides by 256
+    uint64_t cycles_x16 = (uint64_t)(host_pwm_hw.slice[slice].top + 1) * div;
+    uint64_t period = cycles_x16 * 1000000000ull / (16ull * HOST_CLOCK_HZ);
+    return period > 0 ? period : 1;
+}
+
+/**
+ * @brief Puts an alarm in a free slot of the pool.
+ * @param id Alarm ID.
+ * @param target_ns Time the alarm is due (in ns).
+ * @param callback Function to call.
+ * @param user_data Argument for the callback.
+ * @return false if the pool is full.
+ */
+static bool _host_alarm_schedule(alarm_id_t id, uint64_t target_ns, alarm_callback_t callback, void *user_data){
+    for(uint i = 0; i < HOST_ALARM_COUNT; i++){
+        host_alarm_t *alarm = &host_alarms[i];
+        if(alarm->active) continue;
+        alarm->active = true;
+        alarm->id = id;
+        alarm->target_ns = target_ns;
+        alarm->callback = callback;
+        alarm->user_data = user_data;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Runs an alarm callback, and reschedules it as the SDK does:
+ * relative to its previous target if it returns a negative value,
+ * relative to now if positive.
+ * @param id Alarm ID.
+ * @param target_ns Time the alarm was due (in ns).
+ * @param callback Function to call.
+ * @param user_data Argument for the callback.
+ * @return false if the alarm is not rescheduled.
+ */
+static bool _host_alarm_run(alarm_id_t id, uint64_t target_ns, alarm_callback_t callback, void *user_data){
+    int64_t reschedule = callback(id, user_data);
+    if(reschedule == 0) return false;
+    uint64_t next = reschedule < 0 ? target_ns + (uint64_t)(-reschedule) * 1000 : host_time_ns + (uint64_t) reschedule * 1000;
+    return _host_alarm_schedule(id, next, callback, user_data);
+}
+
+/**
+ * @brief Finds the earliest pending event.
+ * @param time_ns Pointer to the time of the event (in ns).
+ * @param index Pointer to the index of the alarm, hardware alarm or PWM slice.
+ * @return Kind of event, HOST_EVENT_NONE if nothing is pending.
+ */
+static uint8_t _host_next_event(uint64_t *time_ns, uint *index){
+    uint8_t kind = HOST_EVENT_NONE;
+    for(uint i = 0; i < HOST_ALARM_COUNT; i++){
+        if(!host_alarms[i].active) continue;
+        if(kind == HOST_EVENT_NONE || host_alarms[i].target_ns < *time_ns){
+            kind = HOST_EVENT_ALARM;
+            *time_ns = host_alarms[i].target_ns;
+            *index = i;
+        }
+    }
+    for(uint i = 0; i < NUM_TIMERS; i++){
+        if(!host_hw_alarms[i].armed) continue;
+        if(kind == HOST_EVENT_NONE || host_hw_alarms[i].target_ns < *time_ns){
+            kind = HOST_EVENT_HW_ALARM;
+            *time_ns = host_hw_alarms[i].target_ns;
+            *index = i;
+        }
+    }
+    if(host_pwm_handler && host_pwm_irq_enabled){
+        for(uint slice = 0; slice < NUM_PWM_SLICES; slice++){
+            if(!(host_pwm_hw.en & host_pwm_hw.inte & (1u << slice))) continue;
+            if(host_pwm_wrap_ns[slice] < host_time_ns){ // Interrupt enabled while running
+                host_pwm_wrap_ns[slice] = host_time_ns + _host_pwm_period_ns(slice);
+            }
+            if(kind == HOST_EVENT_NONE || host_pwm_wrap_ns[slice] < *time_ns){
+                kind = HOST_EVENT_PWM_WRAP;
+                *time_ns = host_pwm_wrap_ns[slice];
+                *index = slice;
+            }
+        }
+    }
+    return kind;
+}
+
+/**
+ * @brief Runs the earliest pending event if it is due by a given time.
+ * @param until_ns Time limit (in ns).
+ * @return false if no event is due.
+ */
+static bool _host_run_next(uint64_t until_ns){
+    uint64_t time_ns = 0;
+    uint index = 0;
+    uint8_t kind = _host_next_event(&time_ns, &index);
+    if(kind == HOST_EVENT_NONE || time_ns > until_ns) return false;
+    if(time_ns > host_time_ns) host_time_ns = time_ns;
+
+    if(kind == HOST_EVENT_ALARM){
+        host_alarm_t alarm = host_alarms[index];
+        host_alarms[index].active = false;
+        _host_alarm_run(alarm.id, alarm.target_ns, alarm.callback, alarm.user_data);
+    } else if(kind == HOST_EVENT_HW_ALARM){
+        host_hw_alarms[index].armed = false;
+        if(host_hw_alarms[index].callback) host_hw_alarms[index].callback(index);
+    } else {
+        host_pwm_wrap_ns[index] += _host_pwm_period_ns(index);
+        host_pwm_hw.intr |= 1u << index;
+        host_pwm_handler();
+    }
+    return true;
+}
+
+/**
+ * @brief Moves time forward, running the events that fall due.
+ * @param until_ns Time to move to (in ns).
+ */
+static void _host_advance(uint64_t until_ns){
+    while(_host_run_next(until_ns)) {}
+    if(until_ns > host_time_ns) host_time_ns = until_ns;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index){
+    return HOST_CLOCK_HZ;
+}
+
+uint64_t time_us_64(void){
+    return host_time_ns / 1000;
+}
+
+void sleep_us(uint64_t us){
+    _host_advance(host_time_ns + us * 1000);
+}
+
+void sleep_ms(uint32_t ms){
+    sleep_us(ms * 1000ull);
+}
+
+/**
+ * @brief Busy wait step: moves time to the next event and runs it,
+ * or by 1 us if nothing is pending.
+ */
+void tight_loop_contents(void){
+    if(!_host_run_next(UINT64_MAX)) host_time_ns += 1000;
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past){
+    alarm_id_t id = ++host_last_id;
+    if(id <= 0) id = host_last_id = 1;
+    if(us == 0){ // Already due
+        if(!fire_if_past) return 0;
+        return _host_alarm_run(id, host_time_ns, callback, user_data) ? id : 0;
+    }
+    return _host_alarm_schedule(id, host_time_ns + us * 1000, callback, user_data) ? id : -1;
+}
+
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void *user_data, bool fire_if_past){
+    return add_alarm_in_us(ms * 1000ull, callback, user_data, fire_if_past);
+}
+
+bool cancel_alarm(alarm_id_t id){
+    for(uint i = 0; i < HOST_ALARM_COUNT; i++){
+        if(host_alarms[i].active && host_alarms[i].id == id){
+            host_alarms[i].active = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+void hardware_alarm_claim(uint alarm_num){
+    host_hw_alarms[alarm_num].claimed = true;
+}
+
+int hardware_alarm_claim_unused(bool required){
+    for(uint i = 0; i < NUM_TIMERS; i++){
+        if(!host_hw_alarms[i].claimed){
+            host_hw_alarms[i].claimed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback){
+    host_hw_alarms[alarm_num].callback = callback;
+}
+
+/**
+ * @brief Arms a hardware alarm.
+ * @return true if the target has already passed, in which case the alarm is not armed.
+ */
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t){
+    uint64_t target_ns = t * 1000;
+    if(target_ns <= host_time_ns) return true;
+    host_hw_alarms[alarm_num].target_ns = target_ns;
+    host_hw_alarms[alarm_num].armed = true;
+    return false;
+}
+
+void hardware_alarm_cancel(uint alarm_num){
+    host_hw_alarms[alarm_num].armed = false;
+}
+
+void hardware_alarm_force_irq(uint alarm_num){
+    host_hw_alarms[alarm_num].target_ns = host_time_ns;
+    host_hw_alarms[alarm_num].armed = true;
+}
+
+void pwm_set_enabled(uint slice_num, bool enabled){
+    bool running = host_pwm_hw.en & (1u << slice_num);
+    if(enabled){
+        if(!running) host_pwm_wrap_ns[slice_num] = host_time_ns + _host_pwm_period_ns(slice_num);
+        host_pwm_hw.slice[slice_num].csr |= PWM_CH0_CSR_EN_BITS;
+        host_pwm_hw.en |= 1u << slice_num;
+    } else {
+        host_pwm_hw.slice[slice_num].csr &= ~PWM_CH0_CSR_EN_BITS;
+        host_pwm_hw.en &= ~(1u << slice_num);
+    }
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority){
+    if(num == PWM_IRQ_WRAP) host_pwm_handler = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled){
+    if(num == PWM_IRQ_WRAP) host_pwm_irq_enabled = enabled;
+}
+
+void gpio_init(uint gpio){
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn){
+}
+
+bool stdio_init_all(void){
+    return true;
+}
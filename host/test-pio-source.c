@@ -0,0 +1,371 @@
+/**
+ * @file test-pio-source.c
+ * @brief Host test that pwm-tone.pio.h holds the program of pwm-tone.pio.
+ * Assembles pwm-tone.pio with a minimal assembler, which covers the PIO
+ * instruction set and the directives pwm-tone.pio uses, and compares the
+ * result with the instruction words, wrap and side-set configuration of the
+ * header the host build uses. The header is written by hand when pioasm is not
+ * available (see CMakeLists.txt), so this test fails when the two differ.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "hardware/pio.h"
+#include "pwm-tone.pio.h"
+
+/**
+ * @def PIO_SOURCE
+ * @brief Path of pwm-tone.pio, set by CMakeLists.txt.
+ */
+#ifndef PIO_SOURCE
+#define PIO_SOURCE "../pwm-tone.pio"
+#endif
+
+/**
+ * @def PIO_MAX_LABELS
+ * @brief Maximum number of labels in the program.
+ */
+#define PIO_MAX_LABELS 32
+
+/**
+ * @def PIO_MAX_TOKENS
+ * @brief Maximum number of tokens in a line.
+ */
+#define PIO_MAX_TOKENS 16
+
+/**
+ * @brief Program assembled from the source.
+ */
+typedef struct asm_program_t {
+    char name[32];
+    uint16_t instructions[PIO_INSTRUCTION_COUNT];
+    uint8_t length;
+    int wrap_target; /**< -1 if not set, then 0. */
+    int wrap; /**< -1 if not set, then the last instruction. */
+    uint8_t sideset_bits; /**< Side-set bits, excluding the enable bit. */
+    bool sideset_optional;
+    char labels[PIO_MAX_LABELS][32];
+    uint8_t label_address[PIO_MAX_LABELS];
+    uint8_t label_count;
+} asm_program_t;
+
+/**
+ * @brief Number of failed checks.
+ */
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)){ \
+        failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while(0)
+
+/**
+ * @brief Line being assembled, for error messages.
+ */
+static int line_number;
+
+/**
+ * @brief Reports a syntax error in the source.
+ * @param message Description of the error.
+ * @param token Offending token.
+ */
+static void syntax_error(const char *message, const char *token){
+    failures++;
+    printf("FAIL %s:%d: %s '%s'\n", PIO_SOURCE, line_number, message, token);
+}
+
+/**
+ * @brief Looks a word up in a table of names.
+ * @param names Names, indexed by their encoding (NULL for unused values).
+ * @param count Number of names.
+ * @param word Word to look up.
+ * @return Encoding of the word, or -1 if not found.
+ */
+static int lookup(const char *const *names, int count, const char *word){
+    for(int i = 0; i < count; i++){
+        if(names[i] && strcmp(names[i], word) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Reads a value: a number, or a label once addresses are known.
+ * @param prog Program being assembled.
+ * @param word Word to read.
+ * @param pass Assembly pass (labels are only resolved in pass 2).
+ * @return Value, or -1 if invalid.
+ */
+static int value(const asm_program_t *prog, const char *word, int pass){
+    if(isdigit((unsigned char) word[0])){
+        char *end;
+        long v = strtol(word, &end, 0);
+        return *end ? -1 : (int) v;
+    }
+    for(int i = 0; i < prog->label_count; i++){
+        if(strcmp(prog->labels[i], word) == 0) return prog->label_address[i];
+    }
+    return pass == 1 ? 0 : -1;
+}
+
+/**
+ * @brief Splits a line into lowercase tokens. Commas separate tokens, and
+ * brackets, '!', '~' and '::' become tokens of their own.
+ * @param line Line, modified in place.
+ * @param tokens Array of tokens to fill.
+ * @return Number of tokens.
+ */
+static int tokenize(char *line, char tokens[PIO_MAX_TOKENS][32]){
+    int count = 0, length = 0;
+    for(char *c = line;; c++){
+        bool single = *c == '[' || *c == ']' || *c == '~' || (*c == '!' && c[1] != '=');
+        bool scope = c[0] == ':' && c[1] == ':';
+        bool separator = !*c || isspace((unsigned char) *c) || *c == ',' || single || scope;
+        if(separator && length){
+            tokens[count++][length] = '\0';
+            length = 0;
+            if(count == PIO_MAX_TOKENS) break;
+        }
+        if(!*c) break;
+        if(single || scope){
+            strcpy(tokens[count++], scope ? "::" : (char[]){*c, '\0'});
+            if(scope) c++;
+            if(count == PIO_MAX_TOKENS) break;
+        } else if(!separator && length < 31){
+            tokens[count][length++] = (char) tolower((unsigned char) *c);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Encodes an instruction, without its side-set and delay.
+ * @param prog Program being assembled.
+ * @param t Tokens of the instruction, without side-set and delay.
+ * @param n Number of tokens.
+ * @param pass Assembly pass.
+ * @return Instruction word, or -1 if invalid.
+ */
+static int encode(const asm_program_t *prog, char t[][32], int n, int pass){
+    static const char *const jmp_conditions[] = {"", "!x", "x--", "!y", "y--", "x!=y", "pin", "!osre"};
+    static const char *const in_sources[] = {"pins", "x", "y", "null", NULL, NULL, "isr", "osr"};
+    static const char *const out_destinations[] = {"pins", "x", "y", "null", "pindirs", "pc", "isr", "exec"};
+    static const char *const mov_destinations[] = {"pins", "x", "y", NULL, "exec", "pc", "isr", "osr"};
+    static const char *const mov_sources[] = {"pins", "x", "y", "null", NULL, "status", "isr", "osr"};
+    static const char *const set_destinations[] = {"pins", "x", "y", NULL, "pindirs"};
+    static const char *const wait_sources[] = {"gpio", "pin", "irq"};
+
+    if(strcmp(t[0], "nop") == 0 && n == 1) return 0xa042; // mov y, y
+    if(strcmp(t[0], "jmp") == 0 && n >= 2 && n <= 4){
+        char name[40] = "";
+        if(n == 4 && strcmp(t[1], "!") == 0) snprintf(name, sizeof(name), "!%s", t[2]); // Split by tokenize()
+        else if(n == 3) snprintf(name, sizeof(name), "%s", t[1]);
+        int condition = n == 4 && !name[0] ? -1 : lookup(jmp_conditions, 8, name);
+        int target = value(prog, t[n - 1], pass);
+        if(condition < 0 || target < 0 || target > 31) return -1;
+        return 0x0000 | condition << 5 | target;
+    }
+    if(strcmp(t[0], "wait") == 0 && (n == 4 || n == 5)){
+        int polarity = value(prog, t[1], pass);
+        int source = lookup(wait_sources, 3, t[2]);
+        int index = value(prog, t[3], pass);
+        bool rel = n == 5 && strcmp(t[4], "rel") == 0;
+        if(polarity < 0 || polarity > 1 || source < 0 || index < 0 || index > 31 || (n == 5 && !rel)) return -1;
+        return 0x2000 | polarity << 7 | source << 5 | (rel ? 0x10 : 0) | index;
+    }
+    if((strcmp(t[0], "in") == 0 || strcmp(t[0], "out") == 0) && n == 3){
+        bool in = t[0][0] == 'i';
+        int operand = in ? lookup(in_sources, 8, t[1]) : lookup(out_destinations, 8, t[1]);
+        int bits = value(prog, t[2], pass);
+        if(operand < 0 || bits < 1 || bits > 32) return -1;
+        return (in ? 0x4000 : 0x6000) | operand << 5 | (bits & 31);
+    }
+    if(strcmp(t[0], "push") == 0 || strcmp(t[0], "pull") == 0){
+        bool pull = t[0][1] == 'u' && t[0][2] == 'l';
+        bool conditional = false, block = true;
+        for(int i = 1; i < n; i++){
+            if(strcmp(t[i], pull ? "ifempty" : "iffull") == 0) conditional = true;
+            else if(strcmp(t[i], "block") == 0) block = true;
+            else if(strcmp(t[i], "noblock") == 0) block = false;
+            else return -1;
+        }
+        return 0x8000 | (pull ? 0x80 : 0) | (conditional ? 0x40 : 0) | (block ? 0x20 : 0);
+    }
+    if(strcmp(t[0], "mov") == 0 && (n == 3 || n == 4)){
+        int destination = lookup(mov_destinations, 8, t[1]);
+        int op = 0;
+        if(n == 4){
+            if(strcmp(t[2], "!") == 0 || strcmp(t[2], "~") == 0) op = 1;
+            else if(strcmp(t[2], "::") == 0) op = 2;
+            else return -1;
+        }
+        int source = lookup(mov_sources, 8, t[n - 1]);
+        if(destination < 0 || source < 0) return -1;
+        return 0xa000 | destination << 5 | op << 3 | source;
+    }
+    if(strcmp(t[0], "irq") == 0 && n >= 2){
+        bool clear = false, wait = false, rel = false;
+        int i = 1;
+        if(strcmp(t[i], "set") == 0 || strcmp(t[i], "nowait") == 0) i++;
+        else if(strcmp(t[i], "wait") == 0){ wait = true; i++; }
+        else if(strcmp(t[i], "clear") == 0){ clear = true; i++; }
+        if(i >= n) return -1;
+        int index = value(prog, t[i++], pass);
+        if(i < n && strcmp(t[i], "rel") == 0){ rel = true; i++; }
+        if(i != n || index < 0 || index > 7) return -1;
+        return 0xc000 | (clear ? 0x40 : 0) | (wait ? 0x20 : 0) | (rel ? 0x10 : 0) | index;
+    }
+    if(strcmp(t[0], "set") == 0 && n == 3){
+        int destination = lookup(set_destinations, 5, t[1]);
+        int data = value(prog, t[2], pass);
+        if(destination < 0 || data < 0 || data > 31) return -1;
+        return 0xe000 | destination << 5 | data;
+    }
+    return -1;
+}
+
+/**
+ * @brief Assembles one line of the source.
+ * @param prog Program being assembled.
+ * @param line Line, modified in place.
+ * @param pass Assembly pass: 1 collects labels, 2 encodes instructions.
+ */
+static void assemble_line(asm_program_t *prog, char *line, int pass){
+    char t[PIO_MAX_TOKENS][32];
+    int n = tokenize(line, t);
+    if(n == 0) return;
+
+    if(t[0][0] == '.'){
+        if(strcmp(t[0], ".program") == 0 && n == 2){
+            snprintf(prog->name, sizeof(prog->name), "%s", t[1]);
+        } else if(strcmp(t[0], ".side_set") == 0 && n >= 2){
+            prog->sideset_bits = (uint8_t) value(prog, t[1], pass);
+            for(int i = 2; i < n; i++){
+                if(strcmp(t[i], "opt") == 0) prog->sideset_optional = true;
+                else syntax_error("unsupported side-set option", t[i]);
+            }
+        } else if(strcmp(t[0], ".wrap_target") == 0){
+            prog->wrap_target = prog->length;
+        } else if(strcmp(t[0], ".wrap") == 0){
+            prog->wrap = prog->length - 1;
+        } else {
+            syntax_error("unsupported directive", t[0]);
+        }
+        return;
+    }
+
+    int first = 0;
+    if(strcmp(t[0], "public") == 0) first++;
+    size_t length = strlen(t[first]);
+    if(length > 1 && t[first][length - 1] == ':'){ // Label
+        if(pass == 1 && prog->label_count < PIO_MAX_LABELS){
+            t[first][length - 1] = '\0';
+            strcpy(prog->labels[prog->label_count], t[first]);
+            prog->label_address[prog->label_count++] = prog->length;
+        }
+        first++;
+        if(first == n) return;
+    }
+
+    // Side-set and delay follow the operands
+    int operands = n, side = -1, delay = 0;
+    for(int i = first; i < n; i++){
+        if(strcmp(t[i], "side") == 0 && i + 1 < n){
+            if(operands == n) operands = i;
+            side = value(prog, t[++i], pass);
+        } else if(strcmp(t[i], "[") == 0 && i + 2 < n && strcmp(t[i + 2], "]") == 0){
+            if(operands == n) operands = i;
+            delay = value(prog, t[i + 1], pass);
+            i += 2;
+        }
+    }
+
+    if(prog->length >= PIO_INSTRUCTION_COUNT){
+        syntax_error("program too long at", t[first]);
+        return;
+    }
+    if(pass == 2){
+        int word = encode(prog, &t[first], operands - first, pass);
+        int side_bits = prog->sideset_bits + (prog->sideset_optional ? 1 : 0);
+        int delay_max = (1 << (5 - side_bits)) - 1;
+        if(word < 0) syntax_error("invalid instruction", t[first]);
+        if(delay < 0 || delay > delay_max) syntax_error("invalid delay in", t[first]);
+        if(side >= (1 << prog->sideset_bits) || (side < 0 && prog->sideset_bits && !prog->sideset_optional)){
+            syntax_error("invalid side-set in", t[first]);
+        }
+        if(side >= 0){
+            int field = prog->sideset_optional ? (0x10 | side << (4 - prog->sideset_bits)) : side << (5 - side_bits);
+            word |= field << 8;
+        }
+        word |= delay << 8;
+        prog->instructions[prog->length] = (uint16_t) word;
+    }
+    prog->length++;
+}
+
+/**
+ * @brief Assembles the first program of a source file.
+ * @param path Path of the source.
+ * @param prog Program to fill.
+ * @return false if the source cannot be read.
+ */
+static bool assemble(const char *path, asm_program_t *prog){
+    memset(prog, 0, sizeof(*prog));
+    for(int pass = 1; pass <= 2; pass++){
+        FILE *f = fopen(path, "r");
+        if(!f) return false;
+        char line[256];
+        bool c_block = false;
+        prog->length = 0;
+        prog->wrap_target = prog->wrap = -1;
+        for(line_number = 1; fgets(line, sizeof(line), f); line_number++){
+            if(line[0] == '%') { c_block = strchr(line, '{') != NULL; continue; } // Code for pioasm outputs
+            if(c_block) continue;
+            char *comment = strchr(line, ';');
+            if(comment) *comment = '\0';
+            comment = strstr(line, "//");
+            if(comment) *comment = '\0';
+            assemble_line(prog, line, pass);
+        }
+        fclose(f);
+    }
+    if(prog->wrap_target < 0) prog->wrap_target = 0;
+    if(prog->wrap < 0) prog->wrap = prog->length - 1;
+    return true;
+}
+
+int main(){
+    asm_program_t prog;
+    if(!assemble(PIO_SOURCE, &prog)){
+        printf("FAIL: cannot read %s\n", PIO_SOURCE);
+        return 1;
+    }
+    CHECK(strcmp(prog.name, "pwm_tone") == 0, "program is '%s', not 'pwm_tone'", prog.name);
+    CHECK(pwm_tone_program.length == prog.length, "header has %u instructions, source %u",
+        pwm_tone_program.length, prog.length);
+    for(uint i = 0; i < prog.length && i < pwm_tone_program.length; i++){
+        CHECK(pwm_tone_program.instructions[i] == prog.instructions[i], "instruction %u is 0x%04x in the header, 0x%04x in the source",
+            i, pwm_tone_program.instructions[i], prog.instructions[i]);
+    }
+
+    pio_sm_config c = pwm_tone_program_get_default_config(0);
+    CHECK(c.wrap_target == prog.wrap_target && c.wrap == prog.wrap, "wrap is %u..%u in the header, %d..%d in the source",
+        c.wrap_target, c.wrap, prog.wrap_target, prog.wrap);
+    CHECK(c.sideset_bit_count == prog.sideset_bits + (prog.sideset_optional ? 1 : 0) && c.sideset_optional == prog.sideset_optional,
+        "side-set is %u bits%s in the header, %u%s in the source", c.sideset_bit_count, c.sideset_optional ? " opt" : "",
+        prog.sideset_bits, prog.sideset_optional ? " opt" : "");
+
+    if(failures){
+        printf("%d check(s) failed: update host/include/pwm-tone.pio.h from pwm-tone.pio\n", failures);
+        return 1;
+    }
+    printf("All checks passed: %u instructions\n", prog.length);
+    return 0;
+}
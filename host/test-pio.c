@@ -0,0 +1,151 @@
+/**
+ * @file test-pio.c
+ * @brief Host test of the PIO backend, run on the cycle model of pwm-tone.pio.
+ * Checks that each half period lasts the value sent to the state machine plus
+ * 4 cycles, the overhead _pio_prepare_freq() subtracts (PIO_TONE_OVERHEAD),
+ * that a new value starts with the next period, and that every note from
+ * NOTE_G1 to NOTE_FS9 is played at the closest period the program can make.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include "pwm-tone.h"
+#include "hardware/clocks.h"
+#include "pio-model.h"
+
+/**
+ * @def PIO_PIN
+ * @brief GPIO pin driven by the state machine under test.
+ */
+#define PIO_PIN 5
+
+/**
+ * @def PIO_PROGRAM_OVERHEAD
+ * @brief Cycles added to each half period by the program, as documented in pwm-tone.pio.
+ */
+#define PIO_PROGRAM_OVERHEAD 4
+
+/**
+ * @brief Number of failed checks.
+ */
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)){ \
+        failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while(0)
+
+static tonegenerator_t gen;
+
+/**
+ * @brief Runs the state machine until the pin changes level.
+ * @param limit Maximum number of cycles.
+ * @return Number of cycles run, 0 if the pin did not change.
+ */
+static uint32_t run_to_edge(uint32_t limit){
+    PIO pio = pio_get_instance(gen.pio);
+    bool level = pio_model_gpio_get(PIO_PIN);
+    for(uint32_t cycles = 1; cycles <= limit; cycles++){
+        pio_model_step(pio, gen.sm);
+        if(pio_model_gpio_get(PIO_PIN) != level) return cycles;
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts the output at a value and waits for its first rising edge.
+ * @param value Half period value, as returned by _pio_prepare_freq().
+ */
+static void start(uint32_t value){
+    _pio_apply_freq(&gen, value);
+    _pio_set_enabled(&gen, true);
+    CHECK(!pio_model_gpio_get(PIO_PIN), "pin high before the first period");
+    CHECK(run_to_edge(16) > 0, "no rising edge after start");
+}
+
+/**
+ * @brief Each half period lasts exactly value + 4 cycles, from the first period on.
+ */
+static void test_half_period(void){
+    static const uint32_t values[] = {1, 2, 3, 100, 5275, 1275506};
+    for(uint i = 0; i < sizeof(values) / sizeof(values[0]); i++){
+        uint32_t value = values[i];
+        uint32_t expected = value + PIO_PROGRAM_OVERHEAD;
+        start(value);
+        for(int phase = 0; phase < 4; phase++){
+            uint32_t cycles = run_to_edge(2 * expected);
+            CHECK(cycles == expected, "value %u: %s phase lasted %u cycles, expected %u",
+                value, (phase & 1) ? "low" : "high", cycles, expected);
+        }
+        _pio_set_enabled(&gen, false);
+        CHECK(!pio_model_gpio_get(PIO_PIN), "pin not low after stopping");
+    }
+}
+
+/**
+ * @brief A value sent while playing is picked up at the start of the next period,
+ * and the last value keeps playing once the FIFO is empty.
+ */
+static void test_pitch_change(void){
+    uint32_t a = 50, b = 80;
+    start(a);
+    run_to_edge(1000); // Into the low phase
+    run_to_edge(1000); // Start of a new period, which has already pulled a
+    _pio_apply_freq(&gen, b);
+    CHECK(run_to_edge(1000) == a + PIO_PROGRAM_OVERHEAD, "high phase changed mid-period");
+    CHECK(run_to_edge(1000) == a + PIO_PROGRAM_OVERHEAD, "low phase changed mid-period");
+    for(int phase = 0; phase < 6; phase++){
+        CHECK(run_to_edge(1000) == b + PIO_PROGRAM_OVERHEAD, "new value not held, phase %d", phase);
+    }
+    CHECK(pio_model_tx_level(pio_get_instance(gen.pio), gen.sm) == 0, "FIFO not drained");
+    _pio_set_enabled(&gen, false);
+}
+
+/**
+ * @brief Every note the library plays gets the closest period, within one cycle
+ * plus the precision of the float computation.
+ */
+static void test_notes(void){
+    double clock = clock_get_hz(clk_sys);
+    for(uint midi = 31; midi <= 126; midi++){ // NOTE_G1 to NOTE_FS9
+        float freq = midi_to_pitch[midi];
+        uint32_t value = _pio_prepare_freq(&gen, freq);
+        start(value);
+        uint32_t high = run_to_edge(UINT32_MAX);
+        uint32_t low = run_to_edge(UINT32_MAX);
+        _pio_set_enabled(&gen, false);
+
+        double ideal = clock / freq;
+        double error = (double)(high + low) - ideal;
+        CHECK(fabs(error) <= 1.0 + ideal * FLT_EPSILON,
+            "MIDI %u (%.3f Hz): period %u cycles, ideal %.2f", midi, freq, high + low, ideal);
+        if(midi == 31 || midi == 126){
+            printf("%s: %.3f Hz, value %u, period %u cycles (ideal %.2f, error %+.2f)\n",
+                midi == 31 ? "NOTE_G1" : "NOTE_FS9", freq, value, high + low, ideal, error);
+        }
+    }
+}
+
+int main(){
+    if(!tone_init_pio(&gen, PIO_PIN)){
+        printf("FAIL: tone_init_pio\n");
+        return 1;
+    }
+    test_half_period();
+    test_pitch_change();
+    test_notes();
+
+    if(failures){
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file melodies-code.h
+ * @brief Predefined melodies as compact bytecode, for melody_code().
+ * Generated from melodies.h by tools/melody-compress.py. Do not edit.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef TONE_MELODIES_CODE_H
+#define TONE_MELODIES_CODE_H
+
+/**
+ * @brief Address of each melody in MELODY_CODE.
+ */
+#define CODE_POSITIVE             0
+#define CODE_NEGATIVE             9
+#define CODE_ERROR                18
+#define CODE_CONFIRM              35
+#define CODE_REJECT               45
+#define CODE_SWEEP                55
+#define CODE_COIN                 80
+#define CODE_LASER                87
+#define CODE_POWERUP              100
+#define CODE_VICTORY              119
+#define CODE_DEFEAT               130
+#define CODE_FANFARE              143
+#define CODE_ALARM_1              154
+#define CODE_ALARM_2              161
+#define CODE_ALARM_3              170
+#define CODE_RINGTONE_1           180
+#define CODE_RINGTONE_2           188
+#define CODE_RINGTONE_3           196
+#define CODE_DANGER               204
+#define CODE_EXPLOSION            212
+#define CODE_DRUM_LOOP            279
+#define CODE_HAPPY_BIRTHDAY       292
+
+/**
+ * @brief Bytecode of all the melodies, and of the subroutines they share.
+ */
+static const uint8_t MELODY_CODE[344] = {
+    0x3C, 0x10, 0x46, 0x10, 0x48, 0x10, 0x81, 0x08, 0x80, 0x48, 0x10, 0x46, 0x10, 0x3C, 0x10, 0x81,
+    0x08, 0x80, 0x86, 0x02, 0x54, 0x20, 0x81, 0x40, 0x87, 0x86, 0x02, 0x3C, 0x20, 0x81, 0x40, 0x87,
+    0x81, 0x08, 0x80, 0x86, 0x04, 0x60, 0x80, 0x81, 0x80, 0x87, 0x81, 0x08, 0x80, 0x86, 0x04, 0x00,
+    0x80, 0x81, 0x80, 0x87, 0x81, 0x08, 0x80, 0x00, 0x80, 0x0C, 0x80, 0x18, 0x80, 0x24, 0x80, 0x30,
+    0x80, 0x3C, 0x80, 0x48, 0x80, 0x54, 0x80, 0x60, 0x80, 0x6C, 0x80, 0x78, 0x80, 0x81, 0x08, 0x80,
+    0x54, 0x10, 0x60, 0x04, 0x81, 0x08, 0x80, 0x6C, 0x80, 0x60, 0x80, 0x54, 0x80, 0x48, 0x80, 0x3C,
+    0x80, 0x81, 0x08, 0x80, 0x48, 0x80, 0x49, 0x80, 0x4A, 0x80, 0x4B, 0x80, 0x4C, 0x80, 0x4D, 0x80,
+    0x4E, 0x80, 0x4F, 0x80, 0x81, 0x08, 0x80, 0x43, 0x08, 0x43, 0x10, 0x43, 0x10, 0x4A, 0x04, 0x81,
+    0x08, 0x80, 0x3C, 0x10, 0x3A, 0x10, 0x37, 0x10, 0x34, 0x10, 0x30, 0x10, 0x81, 0x08, 0x80, 0x3C,
+    0xFC, 0x40, 0x08, 0x43, 0x08, 0x48, 0x02, 0x81, 0x08, 0x80, 0x60, 0x08, 0x5D, 0x08, 0x81, 0x04,
+    0x80, 0x6C, 0x08, 0x81, 0x20, 0x6C, 0x08, 0x81, 0x04, 0x80, 0x86, 0x04, 0x60, 0x20, 0x81, 0xE0,
+    0x87, 0x81, 0x04, 0x80, 0x86, 0x08, 0x69, 0x40, 0x5D, 0x40, 0x87, 0x80, 0x86, 0x08, 0x62, 0x80,
+    0x58, 0x80, 0x87, 0x80, 0x86, 0x08, 0x70, 0x80, 0x6C, 0x80, 0x87, 0x80, 0x86, 0x04, 0x4E, 0x08,
+    0x81, 0xF8, 0x87, 0x80, 0x7F, 0x80, 0x7C, 0x80, 0x78, 0x80, 0x73, 0x80, 0x70, 0x80, 0x6C, 0x80,
+    0x67, 0x80, 0x64, 0x80, 0x60, 0x80, 0x5B, 0x80, 0x58, 0x80, 0x54, 0x80, 0x4F, 0x80, 0x4C, 0x80,
+    0x48, 0x80, 0x43, 0x80, 0x40, 0x80, 0x3C, 0x80, 0x37, 0x80, 0x34, 0x80, 0x30, 0x80, 0x2B, 0x80,
+    0x28, 0x80, 0x24, 0x80, 0x1F, 0x80, 0x1C, 0x80, 0x18, 0x80, 0x13, 0x80, 0x10, 0x80, 0x0C, 0x80,
+    0x07, 0x80, 0x04, 0x80, 0x81, 0x08, 0x80, 0x30, 0x08, 0x78, 0x10, 0x78, 0x10, 0x60, 0x08, 0x78,
+    0x10, 0x78, 0x10, 0x80, 0x88, 0x4F, 0x01, 0x41, 0xFC, 0x40, 0xFE, 0x88, 0x4F, 0x01, 0x43, 0xFC,
+    0x41, 0xFE, 0x3C, 0x04, 0x3C, 0x08, 0x48, 0xFC, 0x45, 0xFC, 0x41, 0xFC, 0x40, 0xFC, 0x3E, 0xFC,
+    0x81, 0x08, 0x46, 0x04, 0x46, 0x08, 0x45, 0xFC, 0x41, 0xFC, 0x43, 0xFC, 0x41, 0xFE, 0x80, 0x3C,
+    0x04, 0x3C, 0x08, 0x3E, 0xFC, 0x3C, 0xFC, 0x89,
+};
+
+#endif // TONE_MELODIES_CODE_H
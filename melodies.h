@@ -276,6 +276,20 @@ note_t EXPLOSION[] = {
     {MELODY_END, 0},
 };
 
+/**
+ * @brief Percussion loop, to be played by a noise generator (see tone_init_noise()).
+ * Pitches set the noise clock rate: low for the kick, high for the hi-hat.
+ */
+note_t DRUM_LOOP[] = {
+    {NOTE_C3, 8},  // Kick
+    {NOTE_C9, 16}, // Hi-hat
+    {NOTE_C9, 16},
+    {NOTE_C7, 8},  // Snare
+    {NOTE_C9, 16},
+    {NOTE_C9, 16},
+    {MELODY_END, 0},
+};
+
 note_t HAPPY_BIRTHDAY[] = {
     {NOTE_C4, 4},
     {NOTE_C4, 8}, 
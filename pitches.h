@@ -149,10 +149,50 @@
  */
 #define MELODY_END  -1.0
 
+/**
+ * @def CHORD
+ * @brief Special value introducing a chord (-2.0 Hz). The measure field holds the number
+ * of notes that follow and make up the chord. They are played as a fast arpeggio,
+ * for the duration of the first one.
+ */
+#define CHORD       -2.0
+
+/**
+ * @def TEMPO
+ * @brief Special value introducing a tempo change (-3.0 Hz). Use the macros below.
+ */
+#define TEMPO       -3.0
+
+/**
+ * @def TEMPO_CHANGE
+ * @brief Melody entry that changes the tempo (in bpm) from the next note on.
+ */
+#define TEMPO_CHANGE(bpm)           {TEMPO, 0, (bpm)}
+
+/**
+ * @def TEMPO_RAMP
+ * @brief Melody entry that moves the tempo gradually to a new value (in bpm)
+ * over the next notes (up to 127): a ritardando if slower, an accelerando if faster.
+ */
+#define TEMPO_RAMP(bpm, notes)      {TEMPO, (notes), (bpm)}
+
+/**
+ * @def MARKER
+ * @brief Special value introducing a marker (-4.0 Hz). Use the macro below.
+ */
+#define MARKER      -4.0
+
+/**
+ * @def MARKER_AT
+ * @brief Melody entry that signals the application, with an ID, when the next note starts.
+ * It takes no time. See tone_set_marker_callback() and tone_marker_poll().
+ */
+#define MARKER_AT(id)               {MARKER, 0, (id)}
+
 /**
  * @brief Array of pitch values for all MIDI notes.
  */
-static const int midi_to_pitch[128] = {
+static const float midi_to_pitch[128] = {
     NOTE_CM1, NOTE_CSM1, NOTE_DM1, NOTE_DSM1, NOTE_EM1, NOTE_FM1, NOTE_FSM1, NOTE_GM1, NOTE_GSM1, NOTE_AM1, NOTE_ASM1, NOTE_BM1,
     NOTE_C0, NOTE_CS0, NOTE_D0, NOTE_DS0, NOTE_E0, NOTE_F0, NOTE_FS0, NOTE_G0, NOTE_GS0, NOTE_A0, NOTE_AS0, NOTE_B0,
     NOTE_C1, NOTE_CS1, NOTE_D1, NOTE_DS1, NOTE_E1, NOTE_F1, NOTE_FS1, NOTE_G1, NOTE_GS1, NOTE_A1, NOTE_AS1, NOTE_B1,
@@ -0,0 +1,163 @@
+/**
+ * @file pwm-tone-alloc.c
+ * @brief Voice allocator for the PWM Tone generation library.
+ * The two channels of a PWM slice share the slice's counter, divider and wrap,
+ * so they always run at the same frequency. The allocator gives independent
+ * voices a slice each, and only puts a companion voice, which follows the
+ * pitch of its leader, on the other channel of a slice.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include "pwm-tone.h"
+#include "hardware/pwm.h"
+
+/**
+ * @brief GPIO pins available to the allocator.
+ */
+static uint32_t alloc_pins;
+
+/**
+ * @brief PWM slices kept away from the allocator.
+ */
+static uint32_t alloc_reserved;
+
+/**
+ * @brief Voice on each channel of each PWM slice (NULL if free).
+ */
+static tonegenerator_t *alloc_voices[NUM_PWM_SLICES][2];
+
+/**
+ * @brief Finds a pin of the budget on a given slice and channel.
+ * @param slice PWM slice number.
+ * @param channel PWM channel number.
+ * @return GPIO pin number, or -1 if none.
+ */
+static int _alloc_find_pin(uint8_t slice, uint8_t channel){
+    for(uint gpio = 0; gpio < 32; gpio++){
+        if(!(alloc_pins & (1u << gpio))) continue;
+        if(pwm_gpio_to_slice_num(gpio) == slice && pwm_gpio_to_channel(gpio) == channel) return gpio;
+    }
+    return -1;
+}
+
+/**
+ * @brief Whether a PWM slice has no voice and is not reserved.
+ * @param slice PWM slice number.
+ */
+static inline bool _alloc_slice_free(uint8_t slice){
+    return !alloc_voices[slice][0] && !alloc_voices[slice][1] && !(alloc_reserved & (1u << slice));
+}
+
+/**
+ * @brief Adds GPIO pins to the budget used by the voice allocator.
+ * @param gpio_mask Mask of the GPIO pins (bit n for GPIO n).
+ */
+void tone_alloc_add_pins(uint32_t gpio_mask){
+    alloc_pins |= gpio_mask;
+}
+
+/**
+ * @brief Keeps a PWM slice away from the voice allocator.
+ * @param slice PWM slice number.
+ * @return false if the slice is already used by a voice.
+ */
+bool tone_alloc_reserve_slice(uint8_t slice){
+    if(slice >= NUM_PWM_SLICES || alloc_voices[slice][0] || alloc_voices[slice][1]) return false;
+    alloc_reserved |= 1u << slice;
+    return true;
+}
+
+/**
+ * @brief Initializes a tone generator on a pin of the budget whose PWM slice is unused.
+ * Slices are taken in order, so that voices are spread one per slice.
+ * @param gen Pointer to the tone generator structure.
+ * @return false if no pin on a free slice is left.
+ */
+bool tone_alloc_voice(tonegenerator_t *gen){
+    for(uint8_t slice = 0; slice < NUM_PWM_SLICES; slice++){
+        if(!_alloc_slice_free(slice)) continue;
+        for(uint8_t channel = 0; channel < 2; channel++){
+            int gpio = _alloc_find_pin(slice, channel);
+            if(gpio < 0) continue;
+            tone_init(gen, gpio);
+            alloc_voices[slice][channel] = gen;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Initializes a companion of a voice, on the other channel of its PWM slice.
+ * Both voices then stop their output by level instead of stopping the slice,
+ * which keeps running for the other one.
+ * @param gen Pointer to the tone generator structure.
+ * @param leader Voice allocated with tone_alloc_voice().
+ * @return false if the other channel of the slice is not in the budget or is used.
+ */
+bool tone_alloc_companion(tonegenerator_t *gen, tonegenerator_t *leader){
+    uint8_t slice = leader->slice;
+    uint8_t channel = leader->channel ^ 1;
+    if(alloc_voices[slice][leader->channel] != leader || alloc_voices[slice][channel]) return false;
+    int gpio = _alloc_find_pin(slice, channel);
+    if(gpio < 0) return false;
+
+    tone_init(gen, gpio);
+    pwm_set_chan_level(slice, channel, 0);
+    gen->slice_mode = TONE_SLICE_COMPANION;
+    leader->slice_mode = TONE_SLICE_SHARED;
+    leader->output_enabled = leader->playing;
+    if(!leader->playing) pwm_set_chan_level(slice, leader->channel, 0);
+    alloc_voices[slice][channel] = gen;
+    return true;
+}
+
+/**
+ * @brief Initializes a tone generator in bridge mode, on both channels of a free PWM slice.
+ * @param gen Pointer to the tone generator structure.
+ * @return false if no free slice has both pins in the budget.
+ */
+bool tone_alloc_bridge(tonegenerator_t *gen){
+    for(uint8_t slice = 0; slice < NUM_PWM_SLICES; slice++){
+        if(!_alloc_slice_free(slice)) continue;
+        int gpio_a = _alloc_find_pin(slice, PWM_CHAN_A);
+        int gpio_b = _alloc_find_pin(slice, PWM_CHAN_B);
+        if(gpio_a < 0 || gpio_b < 0) continue;
+        tone_init_bridge(gen, gpio_a, gpio_b);
+        alloc_voices[slice][PWM_CHAN_A] = alloc_voices[slice][PWM_CHAN_B] = gen;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Stops a voice and returns its pin to the allocator.
+ * Freeing a leader also frees its companion. Freeing a companion gives
+ * the whole slice back to its leader. Freeing a bridge frees both of its pins.
+ * @param gen Pointer to the tone generator structure.
+ */
+void tone_alloc_free(tonegenerator_t *gen){
+    uint8_t slice = gen->slice;
+    if(alloc_voices[slice][gen->channel] != gen) return;
+    tonegenerator_t *other = alloc_voices[slice][gen->channel ^ 1];
+
+    if(gen->slice_mode == TONE_SLICE_SHARED && other) tone_alloc_free(other);
+    stop_melody(gen);
+    stop_tone(gen);
+    alloc_voices[slice][gen->channel] = NULL;
+
+    if(gen->slice_mode == TONE_SLICE_BRIDGE){
+        alloc_voices[slice][gen->channel ^ 1] = NULL;
+        tone_deinit_bridge(gen);
+    } else if(gen->slice_mode == TONE_SLICE_COMPANION){
+        pwm_set_chan_level(slice, gen->channel, 0);
+        if(other){
+            other->slice_mode = TONE_SLICE_OWN;
+            if(!other->playing) pwm_set_enabled(slice, false);
+        }
+    } else {
+        pwm_set_enabled(slice, false);
+    }
+    gen->slice_mode = TONE_SLICE_OWN;
+}
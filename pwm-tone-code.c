@@ -0,0 +1,140 @@
+/**
+ * @file pwm-tone-code.c
+ * @brief Melody bytecode decoder for the PWM Tone generation library.
+ * Melodies can be stored as compact bytecode, with repeated blocks and
+ * subroutines shared between melodies (see tools/melody-compress.py).
+ * Events are decoded one at a time by the scheduler.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include "pwm-tone.h"
+
+/**
+ * @brief Maximum number of control opcodes followed before an event.
+ * Well-formed bytecode never needs more, as each block or call is opened
+ * and closed at most once between two events. This bounds the decoding time.
+ */
+#define MELODY_CODE_MAX_OPS (2 * MELODY_CODE_DEPTH + 2)
+
+/**
+ * @brief Reads a 16-bit little endian argument.
+ * @param p Pointer to the argument.
+ * @return Argument value.
+ */
+static inline uint16_t _code_u16(const uint8_t *p){
+    return p[0] | (p[1] << 8);
+}
+
+/**
+ * @brief Gives the size of an opcode, with its arguments.
+ * @param op Opcode.
+ * @return Size (in bytes).
+ */
+static inline uint8_t _code_op_size(uint8_t op){
+    if(op < 0x80) return 2; // MIDI note
+    switch(op){
+    case MELODY_OP_FREQ:
+    case MELODY_OP_TEMPO:
+        return 4;
+    case MELODY_OP_MARKER:
+    case MELODY_OP_CALL:
+        return 3;
+    case MELODY_OP_REST:
+    case MELODY_OP_CHORD:
+    case MELODY_OP_REPEAT:
+        return 2;
+    }
+    return 1;
+}
+
+/**
+ * @brief Decodes the next event of a melody stored as bytecode.
+ * Control opcodes (repeated blocks, calls and returns) are followed
+ * until an event is found, a bounded number of times. An opcode that does
+ * not fit in the bytecode, after a jump or at its end, ends the melody.
+ * @param code Bytecode.
+ * @param state Decoder state, moved past the event.
+ * @param note Pointer to the event to fill. Invalid bytecode decodes as MELODY_END.
+ */
+void _melody_code_next(const uint8_t *code, melody_code_state_t *state, note_t *note){
+    for(uint8_t ops = 0; ops < MELODY_CODE_MAX_OPS; ops++){
+        if(state->pc >= state->size) break;
+        const uint8_t *p = &code[state->pc];
+        if(state->pc + _code_op_size(p[0]) > state->size) break;
+        uint8_t top = state->depth - 1;
+
+        if(p[0] < 0x80){ // MIDI note
+            note->freq = midi_to_pitch[p[0]];
+            note->measure = (int8_t) p[1];
+            note->arg = 0;
+            state->pc += 2;
+            return;
+        }
+
+        switch(p[0]){
+        case MELODY_OP_REST:
+            note->freq = REST;
+            note->measure = (int8_t) p[1];
+            note->arg = 0;
+            state->pc += 2;
+            return;
+        case MELODY_OP_FREQ:
+            note->freq = _code_u16(&p[1]);
+            note->measure = (int8_t) p[3];
+            note->arg = 0;
+            state->pc += 4;
+            return;
+        case MELODY_OP_CHORD:
+            note->freq = CHORD;
+            note->measure = (int8_t) p[1];
+            note->arg = 0;
+            state->pc += 2;
+            return;
+        case MELODY_OP_TEMPO:
+            note->freq = TEMPO;
+            note->measure = (int8_t) p[1];
+            note->arg = (int16_t) _code_u16(&p[2]);
+            state->pc += 4;
+            return;
+        case MELODY_OP_MARKER:
+            note->freq = MARKER;
+            note->measure = 0;
+            note->arg = (int16_t) _code_u16(&p[1]);
+            state->pc += 3;
+            return;
+        case MELODY_OP_REPEAT:
+            if(state->depth == MELODY_CODE_DEPTH) break;
+            state->count[state->depth] = p[1];
+            state->address[state->depth] = state->pc + 2;
+            state->depth++;
+            state->pc += 2;
+            continue;
+        case MELODY_OP_LOOP:
+            if(state->depth == 0 || state->count[top] == 0) break;
+            if(--state->count[top] > 0){
+                state->pc = state->address[top];
+            } else {
+                state->depth--;
+                state->pc += 1;
+            }
+            continue;
+        case MELODY_OP_CALL:
+            if(state->depth == MELODY_CODE_DEPTH) break;
+            state->count[state->depth] = 0;
+            state->address[state->depth] = state->pc + 3;
+            state->depth++;
+            state->pc = _code_u16(&p[1]);
+            continue;
+        case MELODY_OP_RET:
+            if(state->depth == 0 || state->count[top] != 0) break;
+            state->depth--;
+            state->pc = state->address[top];
+            continue;
+        }
+        break; // MELODY_OP_END, or invalid bytecode
+    }
+    note->freq = MELODY_END;
+    note->measure = 0;
+    note->arg = 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file pwm-tone-marker.c
+ * @brief Marker dispatch for the PWM Tone generation library.
+ * MARKER events in a melody are dispatched by the scheduler interrupt at the
+ * time the next note starts, either to a callback or to a queue read from
+ * the main loop. The dispatch delay is measured, so that it can be checked
+ * against the timing needs of the application.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include "pwm-tone.h"
+#include "hardware/sync.h"
+
+#if PWM_TONE_MARKER_QUEUE_SIZE & (PWM_TONE_MARKER_QUEUE_SIZE - 1)
+#error "PWM_TONE_MARKER_QUEUE_SIZE must be a power of 2"
+#endif
+
+/**
+ * @brief Queue of markers dispatched without a callback.
+ * Written by the scheduler, read by tone_marker_poll().
+ */
+static tone_marker_t marker_queue[PWM_TONE_MARKER_QUEUE_SIZE];
+static volatile uint16_t marker_head;
+static volatile uint16_t marker_tail;
+
+/**
+ * @brief Dispatch statistics.
+ */
+static tone_marker_stats_t marker_stats;
+
+/**
+ * @brief Sets the function called when a melody reaches a MARKER event.
+ * @param gen Pointer to the tone generator structure.
+ * @param callback Marker callback, or NULL to queue markers.
+ * @param user_data Argument for the callback.
+ */
+void tone_set_marker_callback(tonegenerator_t *gen, tone_marker_callback_t callback, void *user_data){
+    uint32_t irq_state = save_and_disable_interrupts();
+    gen->marker_cb = callback;
+    gen->marker_data = user_data;
+    restore_interrupts(irq_state);
+}
+
+/**
+ * @brief Reads the oldest queued marker.
+ * Only the main loop reads the queue, so no lock is needed.
+ * @param marker Pointer to the structure to fill.
+ * @return false if the queue is empty.
+ */
+bool tone_marker_poll(tone_marker_t *marker){
+    uint16_t tail = marker_tail;
+    if(tail == marker_head) return false;
+    __dmb(); // Read the marker after seeing the head move
+    *marker = marker_queue[tail & (PWM_TONE_MARKER_QUEUE_SIZE - 1)];
+    __dmb(); // Release the slot after the marker has been read
+    marker_tail = tail + 1;
+    return true;
+}
+
+/**
+ * @brief Reads the dispatch statistics of the markers.
+ * @param stats Pointer to the structure to fill.
+ */
+void tone_marker_get_stats(tone_marker_stats_t *stats){
+    uint32_t irq_state = save_and_disable_interrupts();
+    *stats = marker_stats;
+    restore_interrupts(irq_state);
+}
+
+/**
+ * @brief Dispatches a marker to the callback of the generator, or to the queue.
+ * Markers can also be reached from thread context, when a melody starts,
+ * so the queue is written with interrupts disabled.
+ * @param gen Pointer to the tone generator structure.
+ * @param id Marker ID.
+ * @param time_us Time the marker was scheduled for (in us since boot).
+ */
+void _tone_marker_dispatch(tonegenerator_t *gen, int16_t id, uint64_t time_us){
+    _PROFILE_BEGIN(TONE_PROFILE_MARKER);
+    uint64_t now = time_us_64();
+    uint32_t latency = now > time_us ? (uint32_t)(now - time_us) : 0;
+
+    if(gen->marker_cb){
+        gen->marker_cb(gen, id, gen->marker_data);
+        uint32_t handler = (uint32_t)(time_us_64() - now);
+        if(handler > marker_stats.handler_max_us) marker_stats.handler_max_us = handler;
+        marker_stats.dispatched++;
+    } else {
+        uint32_t irq_state = save_and_disable_interrupts();
+        uint16_t head = marker_head;
+        if((uint16_t)(head - marker_tail) < PWM_TONE_MARKER_QUEUE_SIZE){
+            tone_marker_t *marker = &marker_queue[head & (PWM_TONE_MARKER_QUEUE_SIZE - 1)];
+            marker->gen = gen;
+            marker->id = id;
+            marker->time_us = time_us;
+            __dmb(); // Publish the marker before the head
+            marker_head = head + 1;
+            marker_stats.dispatched++;
+        } else {
+            marker_stats.dropped++;
+        }
+        restore_interrupts(irq_state);
+    }
+
+    if(latency > marker_stats.latency_max_us) marker_stats.latency_max_us = latency;
+    _PROFILE_END(TONE_PROFILE_MARKER);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file pwm-tone-noise.c
+ * @brief Noise output backend for the PWM Tone generation library.
+ * Drives the output from a 16-bit LFSR clocked by the PWM wrap interrupt,
+ * for percussion and static effects. The note frequency sets the rate at
+ * which the LFSR is clocked, which is heard as the "pitch" of the noise.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include "pwm-tone.h"
+
+#if !PWM_TONE_PWM_ONLY
+
+#include "hardware/pwm.h"
+#include "hardware/irq.h"
+
+/**
+ * @brief Feedback taps of the maximal length 16-bit Galois LFSR.
+ */
+#define NOISE_LFSR_TAPS 0xB400u
+
+/**
+ * @brief Level that keeps the output high for a whole period.
+ */
+#define NOISE_LEVEL_HIGH 0xFFFF
+
+/**
+ * @brief Mask of the PWM slices driven by noise generators.
+ */
+static uint32_t noise_slices;
+
+/**
+ * @brief LFSR state of each PWM slice.
+ */
+static uint16_t noise_lfsr[NUM_PWM_SLICES];
+
+/**
+ * @brief Channel driven by the noise generator of each PWM slice.
+ */
+static uint8_t noise_channel[NUM_PWM_SLICES];
+
+/**
+ * @brief Whether the shared PWM wrap handler has been installed.
+ */
+static bool noise_irq_installed;
+
+/**
+ * @brief PWM wrap interrupt handler. Clocks the LFSR of every noise slice
+ * that wrapped, at a fixed cost per slice.
+ */
+static void _noise_irq_handler(void){
+    _PROFILE_BEGIN(TONE_PROFILE_NOISE_SAMPLE);
+    uint32_t status = pwm_get_irq_status_mask() & noise_slices;
+    while(status){
+        uint slice = __builtin_ctz(status);
+        status &= status - 1;
+        pwm_clear_irq(slice);
+
+        uint16_t lfsr = noise_lfsr[slice];
+        uint16_t bit = lfsr & 1u;
+        lfsr >>= 1;
+        if(bit) lfsr ^= NOISE_LFSR_TAPS;
+        noise_lfsr[slice] = lfsr;
+        pwm_set_chan_level(slice, noise_channel[slice], bit ? NOISE_LEVEL_HIGH : 0);
+    }
+    _PROFILE_END(TONE_PROFILE_NOISE_SAMPLE);
+}
+
+/**
+ * @brief Starts or stops the noise output. When stopped, the pin is driven low.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+void _noise_set_enabled(tonegenerator_t *gen, bool enabled){
+    pwm_set_enabled(gen->slice, false);
+    if(enabled){
+        pwm_clear_irq(gen->slice);
+        pwm_set_irq_enabled(gen->slice, true);
+        pwm_set_enabled(gen->slice, true);
+    } else {
+        pwm_set_irq_enabled(gen->slice, false);
+        pwm_set_chan_level(gen->slice, gen->channel, 0);
+    }
+}
+
+/**
+ * @brief Noise backend. The PWM slice only provides the LFSR clock,
+ * so levels are not supported.
+ */
+const tone_backend_t tone_backend_noise = {
+    .set_freq = _pwm_set_freq,
+    .set_level = NULL,
+    .enable = _noise_set_enabled,
+    .commit = NULL,
+    .prepare_freq = _pwm_prepare_freq,
+    .apply_freq = _pwm_apply_freq,
+};
+
+/**
+ * @brief Initializes a noise generator.
+ * @param gen Pointer to the tone generator structure.
+ * @param gpio GPIO pin number for the tone generator.
+ */
+void tone_init_noise(tonegenerator_t *gen, uint8_t gpio){
+    tone_init(gen, gpio);
+    gen->backend = &tone_backend_noise;
+    pwm_set_chan_level(gen->slice, gen->channel, 0);
+
+    noise_lfsr[gen->slice] = 0xACE1u; // Any non-zero seed
+    noise_channel[gen->slice] = gen->channel;
+    noise_slices |= 1u << gen->slice;
+
+    if(!noise_irq_installed){
+        irq_add_shared_handler(PWM_IRQ_WRAP, _noise_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(PWM_IRQ_WRAP, true);
+        noise_irq_installed = true;
+    }
+}
+
+#endif // !PWM_TONE_PWM_ONLY
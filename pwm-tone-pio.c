@@ -0,0 +1,149 @@
+/**
+ * @file pwm-tone-pio.c
+ * @brief PIO output backend for the PWM Tone generation library.
+ * Generates square waves from a per-voice half-period counter running on
+ * a PIO state machine, so each voice costs no PWM slice and no CPU per edge.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include "pwm-tone.h"
+
+#if !PWM_TONE_PWM_ONLY
+
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "pwm-tone.pio.h"
+
+/**
+ * @brief Number of cycles the PIO program adds to each half period.
+ */
+#define PIO_TONE_OVERHEAD 4
+
+/**
+ * @brief Program offset in each PIO block (-1 if not loaded yet).
+ */
+static int8_t pio_offset[2] = {-1, -1};
+
+/**
+ * @brief Last half period written to each state machine (0 = silent).
+ */
+static uint32_t pio_half_period[2][4];
+
+/**
+ * @brief System clock frequency.
+ */
+static uint32_t pio_clock;
+
+/**
+ * @brief Claims a state machine on the given PIO block, loading the program if needed.
+ * @param gen Pointer to the tone generator structure.
+ * @param index PIO block index.
+ * @return true on success.
+ */
+static bool _pio_claim(tonegenerator_t *gen, uint8_t index){
+    PIO pio = pio_get_instance(index);
+    if(pio_offset[index] < 0 && !pio_can_add_program(pio, &pwm_tone_program)) return false;
+    int sm = pio_claim_unused_sm(pio, false);
+    if(sm < 0) return false;
+    if(pio_offset[index] < 0) pio_offset[index] = pio_add_program(pio, &pwm_tone_program);
+    gen->sm = sm;
+    gen->pio = index;
+    return true;
+}
+
+/**
+ * @brief PIO backend. The duty cycle is fixed at 50%, so levels are not supported.
+ */
+const tone_backend_t tone_backend_pio = {
+    .set_freq = _pio_set_freq,
+    .set_level = NULL,
+    .enable = _pio_set_enabled,
+    .commit = NULL,
+    .prepare_freq = _pio_prepare_freq,
+    .apply_freq = _pio_apply_freq,
+};
+
+/**
+ * @brief Initializes a tone generator driven by a PIO state machine.
+ * @param gen Pointer to the tone generator structure.
+ * @param gpio GPIO pin number for the tone generator.
+ * @return true on success, false if no PIO state machine or program space is free.
+ */
+bool tone_init_pio(tonegenerator_t *gen, uint8_t gpio){
+    if(!_pio_claim(gen, 0) && !_pio_claim(gen, 1)) return false;
+    gen->gpio = gpio;
+    gen->backend = &tone_backend_pio;
+    gen->level = TONE_LEVEL_DEFAULT;
+    gen->tempo = 0;
+    gen->slice_mode = TONE_SLICE_OWN;
+    gen->output_enabled = false;
+    gen->tone_a = gen->melody_a = gen->rest_a = gen->arp_a = 0;
+    gen->marker_cb = NULL;
+    gen->marker_data = NULL;
+    pio_clock = clock_get_hz(clk_sys);
+
+    PIO pio = pio_get_instance(gen->pio);
+    pwm_tone_program_init(pio, gen->sm, pio_offset[gen->pio], gpio);
+    pio_sm_set_pins_with_mask(pio, gen->sm, 0, 1u << gpio);
+    pio_half_period[gen->pio][gen->sm] = 0;
+    return true;
+}
+
+/**
+ * @brief Sets the PIO square wave frequency.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ */
+void _pio_set_freq(tonegenerator_t *gen, float freq){
+    _pio_apply_freq(gen, _pio_prepare_freq(gen, freq));
+}
+
+/**
+ * @brief Precomputes the PIO half period for a frequency.
+ * The half period is rounded to the nearest cycle, so the period is never
+ * more than one cycle away from the exact one (see host/test-pio.c).
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ * @return Half period (in state machine cycles), 0 for silence.
+ */
+uint32_t _pio_prepare_freq(tonegenerator_t *gen, float freq){
+    if(freq <= 0) return 0;
+    uint32_t half_period = (uint32_t)((float) pio_clock / (freq * 2.0f) + 0.5f);
+    return half_period > PIO_TONE_OVERHEAD ? half_period - PIO_TONE_OVERHEAD : 1;
+}
+
+/**
+ * @brief Sends a precomputed half period to the state machine.
+ * If the state machine is running, the new pitch starts with the next period.
+ * @param gen Pointer to the tone generator structure.
+ * @param value Half period (in state machine cycles).
+ */
+void _pio_apply_freq(tonegenerator_t *gen, uint32_t value){
+    pio_half_period[gen->pio][gen->sm] = value;
+    if(value) pio_sm_put(pio_get_instance(gen->pio), gen->sm, value);
+}
+
+/**
+ * @brief Starts or stops the PIO square wave.
+ * The state machine is restarted from the top of the program so that
+ * the first period has the correct length. When stopped, the pin is driven low.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+void _pio_set_enabled(tonegenerator_t *gen, bool enabled){
+    PIO pio = pio_get_instance(gen->pio);
+    uint32_t half_period = pio_half_period[gen->pio][gen->sm];
+    pio_sm_set_enabled(pio, gen->sm, false);
+    if(enabled && half_period){
+        pio_sm_clear_fifos(pio, gen->sm);
+        pio_sm_restart(pio, gen->sm);
+        pio_sm_exec(pio, gen->sm, pio_encode_jmp(pio_offset[gen->pio]));
+        pio_sm_put(pio, gen->sm, half_period);
+        pio_sm_set_enabled(pio, gen->sm, true);
+    } else {
+        pio_sm_set_pins_with_mask(pio, gen->sm, 0, 1u << gen->gpio);
+    }
+}
+
+#endif // !PWM_TONE_PWM_ONLY
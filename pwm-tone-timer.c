@@ -0,0 +1,169 @@
+/**
+ * @file pwm-tone-timer.c
+ * @brief Alarm scheduling for the PWM Tone generation library.
+ * By default, alarms are added to the SDK's default alarm pool. After
+ * tone_timer_init(), the library uses its own hardware alarm and a statically
+ * sized event pool instead, so it never competes with the rest of the firmware
+ * for alarm slots.
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#include "pwm-tone.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+
+/**
+ * @brief Event in the dedicated pool.
+ */
+typedef struct _timer_event_t {
+    uint64_t target; /**< Time the event is due (in us since boot). */
+    alarm_callback_t callback; /**< Function to call when due. */
+    void *user_data; /**< Argument for the callback. */
+    uint16_t generation; /**< Incremented at each use of the slot, to reject stale IDs. */
+    bool active; /**< Whether the event is scheduled. */
+} _timer_event_t;
+
+/**
+ * @brief Dedicated event pool.
+ */
+static _timer_event_t timer_events[PWM_TONE_TIMER_POOL_SIZE];
+
+/**
+ * @brief Hardware alarm owned by the library (-1 to use the default alarm pool).
+ * Read by the inline alarm functions of pwm-tone.h, which only call into this
+ * file when the dedicated pool is enabled.
+ */
+int _tone_timer_alarm = -1;
+
+/**
+ * @brief Pool occupancy counters.
+ */
+static uint8_t timer_used;
+static uint8_t timer_peak;
+static uint32_t timer_overflows;
+
+/**
+ * @brief Builds the ID of the event in a slot. IDs are always positive.
+ * @param slot Slot index.
+ * @return Alarm ID.
+ */
+static inline alarm_id_t _timer_id(uint slot){
+    return (alarm_id_t)(((uint32_t) timer_events[slot].generation << 8) | (slot + 1));
+}
+
+/**
+ * @brief Programs the hardware alarm for the earliest pending event.
+ * If that event is already due, the alarm interrupt is raised immediately.
+ */
+static void _timer_program(void){
+    uint64_t next = UINT64_MAX;
+    for(uint i = 0; i < PWM_TONE_TIMER_POOL_SIZE; i++){
+        if(timer_events[i].active && timer_events[i].target < next) next = timer_events[i].target;
+    }
+    if(next == UINT64_MAX){
+        hardware_alarm_cancel(_tone_timer_alarm);
+    } else if(hardware_alarm_set_target(_tone_timer_alarm, from_us_since_boot(next))){
+        hardware_alarm_force_irq(_tone_timer_alarm); // Target already missed
+    }
+}
+
+/**
+ * @brief Hardware alarm callback. Runs every due event, then reprograms the alarm.
+ * Callbacks follow the SDK convention: a negative return value reschedules the
+ * event relative to its previous target, a positive one relative to now.
+ * @param alarm_num Hardware alarm number.
+ */
+static void _timer_irq(uint alarm_num){
+    uint64_t now = time_us_64();
+    for(uint i = 0; i < PWM_TONE_TIMER_POOL_SIZE; i++){
+        _timer_event_t *ev = &timer_events[i];
+        if(!ev->active || ev->target > now) continue;
+
+        ev->active = false;
+        timer_used--;
+        uint16_t generation = ev->generation;
+        int64_t reschedule = ev->callback(_timer_id(i), ev->user_data);
+
+        // Reschedule, unless the callback reused the slot for a new event
+        if(reschedule != 0 && !ev->active && ev->generation == generation){
+            ev->target = reschedule < 0 ? ev->target - reschedule : time_us_64() + reschedule;
+            ev->active = true;
+            if(++timer_used > timer_peak) timer_peak = timer_used;
+        }
+    }
+    _timer_program();
+}
+
+/**
+ * @brief Makes the library use a dedicated hardware alarm and event pool.
+ * @param alarm_num Hardware alarm number (0-3), or -1 to claim an unused one.
+ * @return true on success, false if no hardware alarm is available.
+ */
+bool tone_timer_init(int alarm_num){
+    if(alarm_num < 0){
+        alarm_num = hardware_alarm_claim_unused(false);
+        if(alarm_num < 0) return false;
+    } else {
+        hardware_alarm_claim(alarm_num);
+    }
+    hardware_alarm_set_callback(alarm_num, _timer_irq);
+    _tone_timer_alarm = alarm_num;
+    return true;
+}
+
+/**
+ * @brief Reads the occupancy statistics of the dedicated event pool.
+ * @param stats Pointer to the structure to fill.
+ */
+void tone_timer_get_stats(tone_timer_stats_t *stats){
+    stats->size = _tone_timer_alarm < 0 ? 0 : PWM_TONE_TIMER_POOL_SIZE;
+    stats->used = timer_used;
+    stats->peak = timer_peak;
+    stats->overflows = timer_overflows;
+}
+
+/**
+ * @brief Schedules a callback on the dedicated pool.
+ * @param us Delay (in us).
+ * @param callback Function to call.
+ * @param user_data Argument for the callback.
+ * @return Alarm ID, or -1 if the pool is full.
+ */
+alarm_id_t _tone_timer_add(uint64_t us, alarm_callback_t callback, void *user_data){
+    alarm_id_t id = -1;
+    uint32_t irq_state = save_and_disable_interrupts();
+    for(uint i = 0; i < PWM_TONE_TIMER_POOL_SIZE; i++){
+        _timer_event_t *ev = &timer_events[i];
+        if(ev->active) continue;
+        ev->target = time_us_64() + us;
+        ev->callback = callback;
+        ev->user_data = user_data;
+        ev->generation++;
+        ev->active = true;
+        if(++timer_used > timer_peak) timer_peak = timer_used;
+        id = _timer_id(i);
+        _timer_program();
+        break;
+    }
+    if(id < 0) timer_overflows++;
+    restore_interrupts(irq_state);
+    return id;
+}
+
+/**
+ * @brief Cancels a callback scheduled on the dedicated pool. Stale and invalid IDs are ignored.
+ * @param id Alarm ID.
+ */
+void _tone_timer_cancel(alarm_id_t id){
+    uint slot = (id & 0xFF) - 1;
+    if(slot >= PWM_TONE_TIMER_POOL_SIZE) return;
+    uint32_t irq_state = save_and_disable_interrupts();
+    _timer_event_t *ev = &timer_events[slot];
+    if(ev->active && _timer_id(slot) == id){
+        ev->active = false;
+        timer_used--;
+        _timer_program();
+    }
+    restore_interrupts(irq_state);
+}
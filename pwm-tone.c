@@ -9,39 +9,181 @@
 #include "pwm-tone.h"
 #include "hardware/pwm.h"
 #include "hardware/clocks.h"
+#include "hardware/sync.h"
 #include <stdlib.h>
 
 /**
- * @brief Alarm IDs for tone, melody, and rest.
+ * @brief System clock frequency.
  */
-static alarm_id_t tone_a;
-static alarm_id_t melody_a;
-static alarm_id_t rest_a;
+static uint32_t clock;
 
 /**
- * @brief System clock frequency.
+ * @brief Default rest duration (10ms).
  */
-static uint32_t clock;
+static uint16_t rest_duration = 10;
 
 /**
- * @brief Melody repeat counter.
+ * @brief Default tempo (120bpm).
  */
-static uint16_t melody_repeat;
+static uint16_t tempo = 120;
 
 /**
- * @brief Current melody index.
+ * @brief Default interval between arpeggiated chord notes (16ms, about 60Hz).
  */
-static uint16_t melody_index;
+static uint16_t arpeggio_interval = 16;
 
 /**
- * @brief Default rest duration (10ms).
+ * @brief Callback for the tone playback.
+ * @param id Alarm ID.
+ * @param user_data Pointer to the tone generator structure.
+ * @return 0 on success.
  */
-static uint16_t rest_duration = 10;
+static int64_t _tone_complete(alarm_id_t id, void *user_data);
 
 /**
- * @brief Default tempo (120bpm).
+ * @brief Callback for the melody note playback.
+ * @param id Alarm ID.
+ * @param user_data Pointer to the tone generator structure.
+ * @return 0 on success.
  */
-static uint16_t tempo = 120;
+static int64_t _melody_note_complete(alarm_id_t id, void *user_data);
+
+/**
+ * @brief Callback for the rest period.
+ * @param id Alarm ID.
+ * @param user_data Pointer to the tone generator structure.
+ * @return 0 on success.
+ */
+static int64_t _rest_complete(alarm_id_t id, void *user_data);
+
+/**
+ * @brief Callback for the arpeggio steps.
+ * @param id Alarm ID.
+ * @param user_data Pointer to the tone generator structure.
+ * @return Negative interval to the next step (in us).
+ */
+static int64_t _arpeggio_step(alarm_id_t id, void *user_data);
+
+/**
+ * @brief Waits for a streamed melody whose buffer is empty.
+ * @param gen Pointer to the tone generator structure.
+ */
+static void _melody_underrun(tonegenerator_t *gen);
+
+/**
+ * @brief Computes the duration of the next note, at the current tempo.
+ * @param mel Pointer to the melody.
+ * @param measure Measure of the note (negative for dotted notes).
+ * @return Duration (in us), 0 for a measure of 0.
+ */
+static inline uint32_t _note_duration(melody_t *mel, int8_t measure);
+
+/**
+ * @brief PWM backend.
+ */
+const tone_backend_t tone_backend_pwm = {
+    .set_freq = _pwm_set_freq,
+    .set_level = _pwm_set_level,
+    .enable = _pwm_set_enabled,
+    .commit = NULL,
+    .prepare_freq = _pwm_prepare_freq,
+    .apply_freq = _pwm_apply_freq,
+};
+
+/**
+ * @brief Sets the output frequency through the backend.
+ * Like the other backend calls below, it resolves to the PWM function
+ * at compile time with PWM_TONE_PWM_ONLY, and is then inlined: the PWM
+ * functions are __force_inline, so their calls here cost no call either.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ */
+static inline void _backend_set_freq(tonegenerator_t *gen, float freq){
+#if PWM_TONE_PWM_ONLY
+    _pwm_set_freq(gen, freq);
+#else
+    gen->backend->set_freq(gen, freq);
+#endif
+}
+
+/**
+ * @brief Sets the output level through the backend, if it supports levels.
+ * @param gen Pointer to the tone generator structure.
+ * @param level Level, in ten-thousandths of a period.
+ */
+static inline void _backend_set_level(tonegenerator_t *gen, uint16_t level){
+#if PWM_TONE_PWM_ONLY
+    _pwm_set_level(gen, level);
+#else
+    if (gen->backend->set_level) gen->backend->set_level(gen, level);
+#endif
+}
+
+/**
+ * @brief Starts or stops the output through the backend.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+static inline void _backend_enable(tonegenerator_t *gen, bool enabled){
+#if PWM_TONE_PWM_ONLY
+    _pwm_set_enabled(gen, enabled);
+#else
+    gen->backend->enable(gen, enabled);
+#endif
+}
+
+/**
+ * @brief Applies the pending changes of the backend, if it buffers them.
+ * @param gen Pointer to the tone generator structure.
+ */
+static inline void _backend_commit(tonegenerator_t *gen){
+#if !PWM_TONE_PWM_ONLY
+    if (gen->backend->commit) gen->backend->commit(gen);
+#endif
+}
+
+/**
+ * @brief Backends without prepare_freq/apply_freq get the frequency itself,
+ * stored as the bits of a float.
+ */
+typedef union {
+    float freq;
+    uint32_t value;
+} _freq_value_t;
+
+/**
+ * @brief Precomputes the backend value for a frequency.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ * @return Backend value, to pass to _backend_apply_freq().
+ */
+static inline uint32_t _backend_prepare_freq(tonegenerator_t *gen, float freq){
+#if PWM_TONE_PWM_ONLY
+    return _pwm_prepare_freq(gen, freq);
+#else
+    if (gen->backend->prepare_freq) return gen->backend->prepare_freq(gen, freq);
+    _freq_value_t v = { .freq = freq };
+    return v.value;
+#endif
+}
+
+/**
+ * @brief Applies a value returned by _backend_prepare_freq().
+ * @param gen Pointer to the tone generator structure.
+ * @param value Backend value.
+ */
+static inline void _backend_apply_freq(tonegenerator_t *gen, uint32_t value){
+#if PWM_TONE_PWM_ONLY
+    _pwm_apply_freq(gen, value);
+#else
+    if (gen->backend->apply_freq) {
+        gen->backend->apply_freq(gen, value);
+    } else {
+        _freq_value_t v = { .value = value };
+        gen->backend->set_freq(gen, v.freq);
+    }
+#endif
+}
 
 /**
  * @brief Initializes the tone generator.
@@ -50,14 +192,131 @@ static uint16_t tempo = 120;
  */
 void tone_init(tonegenerator_t *gen, uint8_t gpio){
     gen->gpio = gpio;
+    gen->backend = &tone_backend_pwm;
+    gen->level = TONE_LEVEL_DEFAULT;
+    gen->tempo = 0;
     gen->slice = pwm_gpio_to_slice_num(gpio);
     gen->channel = pwm_gpio_to_channel(gpio);
+    gen->slice_mode = TONE_SLICE_OWN;
+    gen->output_enabled = false;
+    gen->tone_a = gen->melody_a = gen->rest_a = gen->arp_a = 0;
+    gen->marker_cb = NULL;
+    gen->marker_data = NULL;
     gpio_init(gpio);
     gpio_set_function(gpio, GPIO_FUNC_PWM);
     pwm_set_chan_level(gen->slice, gen->channel, 2048);
     clock = clock_get_hz(clk_sys);
 }
 
+/**
+ * @brief Initializes a tone generator in bridge mode, driving a speaker or piezo
+ * between two pins in antiphase, for twice the voltage swing.
+ * @param gen Pointer to the tone generator structure.
+ * @param gpio GPIO pin number for the first terminal.
+ * @param gpio_inverted GPIO pin number for the second terminal, on the other channel of the same PWM slice.
+ * @return false if the pins are not the two channels of one PWM slice.
+ */
+bool tone_init_bridge(tonegenerator_t *gen, uint8_t gpio, uint8_t gpio_inverted){
+    if (pwm_gpio_to_slice_num(gpio) != pwm_gpio_to_slice_num(gpio_inverted) ||
+        pwm_gpio_to_channel(gpio) == pwm_gpio_to_channel(gpio_inverted)) return false;
+    tone_init(gen, gpio);
+    gpio_init(gpio_inverted);
+    gpio_set_function(gpio_inverted, GPIO_FUNC_PWM);
+    gen->slice_mode = TONE_SLICE_BRIDGE;
+    pwm_set_output_polarity(gen->slice, gen->channel != PWM_CHAN_A, gen->channel == PWM_CHAN_A);
+    pwm_set_wrap(gen->slice, 10000);
+    _pwm_set_enabled(gen, false); // Runs silently from now on
+    pwm_set_enabled(gen->slice, true);
+    return true;
+}
+
+/**
+ * @brief Takes a tone generator out of bridge mode, undoing tone_init_bridge().
+ * The output is stopped, and the slice is left stopped with both pins low and
+ * its polarity restored, so the pins can be used for something else.
+ * @param gen Pointer to the tone generator structure.
+ */
+void tone_deinit_bridge(tonegenerator_t *gen){
+    if (gen->slice_mode != TONE_SLICE_BRIDGE) return;
+    stop_melody(gen);
+    stop_tone(gen);
+    pwm_set_enabled(gen->slice, false);
+    // The inverted pin is held low by a full level until the inversion is
+    // removed: both writes go back to back, so it is never high for more than a few cycles
+    uint32_t irq_state = save_and_disable_interrupts();
+    pwm_set_chan_level(gen->slice, PWM_CHAN_A, 0);
+    pwm_set_chan_level(gen->slice, PWM_CHAN_B, 0);
+    pwm_set_output_polarity(gen->slice, false, false);
+    restore_interrupts(irq_state);
+    gen->slice_mode = TONE_SLICE_OWN;
+    gen->output_enabled = false;
+}
+
+#if !PWM_TONE_PWM_ONLY
+/**
+ * @brief Initializes a tone generator driven by a custom backend.
+ * @param gen Pointer to the tone generator structure.
+ * @param backend Backend operations.
+ * @param data Context made available to the backend as gen->backend_data.
+ */
+void tone_init_backend(tonegenerator_t *gen, const tone_backend_t *backend, void *data){
+    gen->backend = backend;
+    gen->backend_data = data;
+    gen->level = TONE_LEVEL_DEFAULT;
+    gen->tempo = 0;
+    gen->slice_mode = TONE_SLICE_OWN;
+    gen->output_enabled = false;
+    gen->tone_a = gen->melody_a = gen->rest_a = gen->arp_a = 0;
+    gen->marker_cb = NULL;
+    gen->marker_data = NULL;
+}
+#endif
+
+/**
+ * @brief Schedules a callback of a generator and stores its alarm ID.
+ * If the callback runs at once, it may already have stored the ID of the alarm
+ * it scheduled, so the slot is only written when an alarm is pending.
+ * If no alarm is left, the generator is stopped, as nothing would end its note.
+ * @param slot Pointer to the alarm ID to update, cleared first.
+ * @param us Delay (in us).
+ * @param callback Function to call.
+ * @param gen Pointer to the tone generator structure, passed to the callback.
+ */
+static inline void _tone_alarm_set(alarm_id_t *slot, uint64_t us, alarm_callback_t callback, tonegenerator_t *gen){
+    *slot = 0;
+    alarm_id_t id = _tone_alarm_add(us, callback, gen);
+    if(id > 0){
+        *slot = id;
+    } else if(id < 0){
+        stop_melody(gen);
+        stop_tone(gen);
+    }
+}
+
+/**
+ * @brief Stops the arpeggio of the chord playing, if any.
+ * @param gen Pointer to the tone generator structure.
+ */
+static inline void _arpeggio_stop(tonegenerator_t *gen){
+    if (gen->arp_count == 0) return; // No chord, so no alarm either
+    _tone_alarm_cancel(gen->arp_a);
+    gen->arp_a = 0;
+    gen->arp_count = 0;
+}
+
+/**
+ * @brief Cancels the alarms of the tone or melody playing, and its arpeggio,
+ * so that none of them acts on what is started next.
+ * @param gen Pointer to the tone generator structure.
+ */
+static void _tone_cancel_alarms(tonegenerator_t *gen){
+    if (gen->tone_a) _tone_alarm_cancel(gen->tone_a);
+    if (gen->melody_a) _tone_alarm_cancel(gen->melody_a);
+    if (gen->rest_a) _tone_alarm_cancel(gen->rest_a);
+    gen->tone_a = gen->melody_a = gen->rest_a = 0;
+    _arpeggio_stop(gen);
+}
+
 /**
  * @brief Plays a single tone.
  * @param gen Pointer to the tone generator structure.
@@ -66,9 +325,10 @@ void tone_init(tonegenerator_t *gen, uint8_t gpio){
  */
 void tone(tonegenerator_t *gen, int freq, uint16_t duration) {
     if(freq != REST){
+        _arpeggio_stop(gen);
         _tone_pwm_on(gen, freq);
-        if (tone_a) cancel_alarm(tone_a);
-        tone_a = add_alarm_in_ms(duration, _tone_complete, gen, true);
+        if (gen->tone_a) _tone_alarm_cancel(gen->tone_a);
+        _tone_alarm_set(&gen->tone_a, duration * 1000ull, _tone_complete, gen);
     }
 }
 
@@ -78,16 +338,158 @@ void tone(tonegenerator_t *gen, int freq, uint16_t duration) {
  * @param notes Array of notes to play.
  * @param repeat Number of times to repeat the melody.
  */
-void melody(tonegenerator_t *gen, note_t *notes, int8_t repeat){
-    melody_repeat = repeat;
-    melody_index = 0;
-    melody_t mel;
+void melody(tonegenerator_t *gen, const note_t *notes, int8_t repeat){
+    melody_t mel = {0};
     mel.notes = notes;
+    mel.index = 0;
+    mel.repeat = repeat;
+    if (gen->tempo) _melody_tempo(&mel, gen->tempo, 0);
+    mel.deadline_us = time_us_64();
+    _tone_cancel_alarms(gen);
+    gen->mel = mel;
+    gen->playing = true;
+    _melody_step(gen);
+}
+
+/**
+ * @brief Plays a melody precomputed by the C++ melody builder (pwm-tone.hpp).
+ * Note durations come from the table, so the tempo is the one it was built with.
+ * Frequency values are used when the backend is driven by a PWM divider and
+ * the system clock matches the one of the table.
+ * @param gen Pointer to the tone generator structure.
+ * @param table Precomputed melody.
+ * @param repeat Number of times to repeat the melody.
+ */
+void melody_table(tonegenerator_t *gen, const melody_table_t *table, int8_t repeat){
+    melody_t mel = {0};
+    mel.notes = table->notes;
+    mel.repeat = repeat;
+    mel.durations = table->duration_us;
+#if PWM_TONE_PWM_ONLY
+    bool pwm_divider = true;
+#else
+    bool pwm_divider = gen->backend->prepare_freq == _pwm_prepare_freq;
+#endif
+    if (pwm_divider && table->clock_hz == clock) {
+        mel.freq_values = table->freq_values;
+        pwm_set_wrap(gen->slice, 10000); // Otherwise set along with each frequency
+    }
+    mel.deadline_us = time_us_64();
+    _tone_cancel_alarms(gen);
     gen->mel = mel;
     gen->playing = true;
     _melody_step(gen);
 }
 
+/**
+ * @brief Plays a melody stored as compact bytecode.
+ * @param gen Pointer to the tone generator structure.
+ * @param code Bytecode, shared by all the melodies and subroutines it contains.
+ * @param size Size of the bytecode (in bytes). Addresses past it end the melody.
+ * @param entry Address of the first opcode of the melody.
+ * @param repeat Number of times to repeat the melody.
+ */
+void melody_code(tonegenerator_t *gen, const uint8_t *code, uint16_t size, uint16_t entry, int8_t repeat){
+    melody_t mel = {0};
+    mel.code = code;
+    mel.code_entry = entry;
+    mel.code_state.pc = entry;
+    mel.code_state.size = size;
+    mel.repeat = repeat;
+    if (gen->tempo) _melody_tempo(&mel, gen->tempo, 0);
+    mel.deadline_us = time_us_64();
+    _tone_cancel_alarms(gen);
+    gen->mel = mel;
+    gen->playing = true;
+    _melody_step(gen);
+}
+
+/**
+ * @brief Plays a melody pulled from a source, in constant RAM.
+ * @param gen Pointer to the tone generator structure.
+ * @param source Source of the melody events.
+ * @param buffer Ring buffer for prefetched events. Chords that do not fit in it are skipped.
+ * @param size Number of events in the buffer (at least TONE_ARPEGGIO_MAX + 2).
+ * @param repeat Number of times to repeat the melody. Repeats need source->rewind.
+ * @return false if the buffer is too small, in which case nothing is played.
+ */
+bool melody_stream(tonegenerator_t *gen, const melody_source_t *source, note_t *buffer, uint16_t size, int8_t repeat){
+    // The ring holds size - 1 events, and must hold the largest chord that is played
+    if (size < TONE_ARPEGGIO_MAX + 2) return false;
+    melody_t mel = {0};
+    mel.source = source;
+    mel.buffer = buffer;
+    mel.size = size;
+    mel.repeat = repeat;
+    mel.source_repeat = mel.repeat;
+    if (gen->tempo) _melody_tempo(&mel, gen->tempo, 0);
+    mel.deadline_us = time_us_64();
+    _tone_cancel_alarms(gen);
+    gen->mel = mel;
+    melody_stream_refill(gen);
+    gen->playing = true;
+    _melody_step(gen);
+    return true;
+}
+
+/**
+ * @brief Pulls events from the source of a streamed melody into its buffer.
+ * After a MELODY_END event, the source is rewound and reading goes on while
+ * repeats remain, so the next pass is already buffered when the scheduler gets there.
+ * @param gen Pointer to the tone generator structure.
+ * @return Number of events read.
+ */
+uint16_t melody_stream_refill(tonegenerator_t *gen){
+    melody_t *mel = &gen->mel;
+    if (!mel->source) return 0;
+
+    uint16_t total = 0;
+    while (!mel->eof) {
+        uint16_t head = mel->head;
+        uint16_t space = (mel->tail + mel->size - head - 1) % mel->size;
+        if (space == 0) break;
+        if (space > mel->size - head) space = mel->size - head; // Up to the end of the ring
+
+        note_t *notes = &mel->buffer[head];
+        uint16_t n = mel->source->read(mel->source->context, notes, space);
+        if (n == 0) {
+            notes[0].freq = MELODY_END;
+            notes[0].measure = 0;
+            n = 1;
+        }
+        uint16_t kept = 0;
+        for (uint16_t i = 0; i < n; i++) {
+            note_t note = notes[i];
+            if (note.freq == MELODY_END) {
+                mel->skip = 0;
+                notes[kept++] = note;
+                if (mel->source_repeat > 0) mel->source_repeat--;
+                if (mel->source_repeat != 0 && mel->source->rewind) {
+                    mel->source->rewind(mel->source->context);
+                } else {
+                    mel->eof = true;
+                }
+                break;
+            }
+            if (mel->skip > 0) { // Note of a chord that can never fit in the ring
+                mel->skip--;
+                continue;
+            }
+            if (note.freq == CHORD && (uint8_t) note.measure + 1 >= mel->size) {
+                mel->skip = (uint8_t) note.measure;
+                continue;
+            }
+            notes[kept++] = note;
+        }
+        if (kept == 0) continue; // All dropped, read on
+        n = kept;
+        __dmb(); // Events must be visible before the head moves
+        mel->head = (head + n) % mel->size;
+        total += n;
+    }
+    return total;
+}
+
 /**
  * @brief Sets the tempo (in bpm).
  * @param bpm Tempo value (in bpm).
@@ -96,6 +498,45 @@ void set_tempo(uint16_t bpm){
     tempo = bpm;
 }
 
+/**
+ * @brief Sets the tempo of the melodies played by a tone generator.
+ * @param gen Pointer to the tone generator structure.
+ * @param bpm Tempo value (in bpm), 0 to follow set_tempo().
+ */
+void tone_set_tempo(tonegenerator_t *gen, uint16_t bpm){
+    // The tempo state is also changed by TEMPO events, in interrupt context
+    uint32_t irq_state = save_and_disable_interrupts();
+    gen->tempo = bpm;
+    if (bpm) {
+        _melody_tempo(&gen->mel, bpm, 0);
+    } else {
+        gen->mel.tempo.fixed = false;
+        gen->mel.tempo.ramp_notes = 0;
+    }
+    restore_interrupts(irq_state);
+}
+
+/**
+ * @brief Sets the interval between arpeggiated chord notes (in ms).
+ * @param interval Arpeggio interval (in ms).
+ */
+void set_arpeggio_interval(uint16_t interval){
+    arpeggio_interval = interval;
+}
+
+/**
+ * @brief Sets the output level (duty cycle) of a tone generator.
+ * @param gen Pointer to the tone generator structure.
+ * @param level Level, in ten-thousandths of a period (0 to 10000).
+ */
+void tone_set_level(tonegenerator_t *gen, uint16_t level){
+    gen->level = level;
+    if(gen->playing){
+        _backend_set_level(gen, level);
+        _backend_commit(gen);
+    }
+}
+
 /**
  * @brief Sets the rest duration (in ms).
  * @param duration Rest duration value (in ms).
@@ -109,7 +550,8 @@ void set_rest_duration(uint16_t duration){
  * @param gen Pointer to the tone generator structure.
  */
 void stop_tone(tonegenerator_t *gen){
-    pwm_set_enabled(gen->slice, false);
+    _backend_enable(gen, false);
+    _backend_commit(gen);
     gen->playing = false;
 }
 
@@ -118,9 +560,213 @@ void stop_tone(tonegenerator_t *gen){
  * @param gen Pointer to the tone generator structure.
  */
 void stop_melody(tonegenerator_t *gen){
-    if (tone_a) cancel_alarm(tone_a);
-    if (melody_a) cancel_alarm(melody_a);
-    pwm_set_enabled(gen->slice, false);
+    _tone_cancel_alarms(gen);
+    gen->mel.paused = false;
+    _backend_enable(gen, false);
+    _backend_commit(gen);
+}
+
+/**
+ * @brief Pauses the melody, keeping the time left in the current note.
+ * @param gen Pointer to the tone generator structure.
+ */
+void melody_pause(tonegenerator_t *gen){
+    melody_t *mel = &gen->mel;
+    uint32_t irq_state = save_and_disable_interrupts();
+    if (gen->playing && !mel->paused) {
+        if (gen->melody_a) _tone_alarm_cancel(gen->melody_a);
+        if (gen->rest_a) _tone_alarm_cancel(gen->rest_a);
+        if (gen->arp_a) _tone_alarm_cancel(gen->arp_a);
+        gen->melody_a = gen->rest_a = gen->arp_a = 0;
+        int64_t remaining = (int64_t)(mel->deadline_us - time_us_64());
+        mel->remaining_us = remaining > 0 ? remaining : 0;
+        mel->paused = true;
+        _backend_enable(gen, false);
+        _backend_commit(gen);
+    }
+    restore_interrupts(irq_state);
+}
+
+/**
+ * @brief Resumes a paused melody where it stopped.
+ * A note is played again at its pitch, or at the current step of its chord.
+ * @param gen Pointer to the tone generator structure.
+ */
+void melody_resume(tonegenerator_t *gen){
+    melody_t *mel = &gen->mel;
+    uint32_t irq_state = save_and_disable_interrupts();
+    if (mel->paused) {
+        mel->paused = false;
+        mel->deadline_us = time_us_64() + mel->remaining_us;
+        if (mel->phase == MELODY_PHASE_NOTE) {
+            if (mel->freq != REST) {
+                _tone_pwm_on(gen, mel->freq);
+                if (gen->arp_count > 1) {
+                    _backend_apply_freq(gen, gen->arp_values[gen->arp_step]);
+                    _backend_commit(gen);
+                    _tone_alarm_set(&gen->arp_a, arpeggio_interval * 1000ull, _arpeggio_step, gen);
+                }
+            }
+            if (gen->playing) _tone_alarm_set(&gen->melody_a, mel->remaining_us, _melody_note_complete, gen);
+        } else {
+            _tone_alarm_set(&gen->rest_a, mel->remaining_us, _rest_complete, gen);
+        }
+    }
+    restore_interrupts(irq_state);
+}
+
+/**
+ * @brief Lists the start time of each note of a melody.
+ * Durations come from mel->durations when set, otherwise from the tempo state.
+ * @param mel Pointer to the melody state used for timing.
+ * @param notes Array of notes.
+ * @param entries Array to fill, one entry per note, rest or chord.
+ * @param max Number of entries in the array.
+ * @return Number of entries written.
+ */
+static uint16_t _melody_index_build(melody_t *mel, const note_t *notes, melody_index_entry_t *entries, uint16_t max){
+    uint32_t rest_us = rest_duration * 1000u;
+    uint32_t time_us = 0;
+    uint16_t count = 0;
+    uint16_t i = 0;
+
+    while (count < max && notes[i].freq != MELODY_END) {
+        note_t note = notes[i];
+        if (note.freq == TEMPO) {
+            _melody_tempo(mel, note.arg, note.measure);
+            i++;
+            continue;
+        }
+        if (note.freq == MARKER || (note.freq == CHORD && note.measure == 0)) {
+            i++;
+            continue;
+        }
+        melody_index_entry_t *entry = &entries[count++];
+        entry->start_us = time_us;
+        entry->position = i;
+        entry->tempo = mel->tempo;
+        if (note.freq == CHORD) {
+            entry->duration_us = mel->durations ? mel->durations[i] : _note_duration(mel, notes[i + 1].measure);
+            i += note.measure + 1;
+        } else {
+            entry->duration_us = mel->durations ? mel->durations[i] : _note_duration(mel, note.measure);
+            i++;
+        }
+        time_us += entry->duration_us + rest_us;
+    }
+    return count;
+}
+
+/**
+ * @brief Builds a seek index for a melody, listing the start time of each note.
+ * Each entry stores the tempo state before its note, so that seeking
+ * does not need to replay the tempo changes that precede it.
+ * @param gen Pointer to the tone generator structure that will play the melody.
+ * @param notes Array of notes.
+ * @param entries Array to fill, one entry per note, rest or chord.
+ * @param max Number of entries in the array.
+ * @return Number of entries written.
+ */
+uint16_t melody_index_build(tonegenerator_t *gen, const note_t *notes, melody_index_entry_t *entries, uint16_t max){
+    melody_t mel = {0};
+    if (gen->tempo) _melody_tempo(&mel, gen->tempo, 0);
+    return _melody_index_build(&mel, notes, entries, max);
+}
+
+/**
+ * @brief Builds a seek index for a melody played with melody_table(),
+ * from the durations precomputed in the table.
+ * @param table Precomputed melody.
+ * @param entries Array to fill, one entry per note, rest or chord.
+ * @param max Number of entries in the array.
+ * @return Number of entries written.
+ */
+uint16_t melody_index_build_table(const melody_table_t *table, melody_index_entry_t *entries, uint16_t max){
+    melody_t mel = {0};
+    mel.durations = table->duration_us;
+    return _melody_index_build(&mel, table->notes, entries, max);
+}
+
+/**
+ * @brief Moves the melody playing to an index entry, plus an offset.
+ * The event is started as usual, then its alarm is moved to account for the offset.
+ * @param gen Pointer to the tone generator structure.
+ * @param entry Index entry to move to.
+ * @param offset_us Time from the start of the entry (in us).
+ */
+static void _melody_seek(tonegenerator_t *gen, const melody_index_entry_t *entry, uint32_t offset_us){
+    melody_t *mel = &gen->mel;
+    uint32_t irq_state = save_and_disable_interrupts();
+    bool paused = mel->paused;
+
+    if (gen->melody_a) _tone_alarm_cancel(gen->melody_a);
+    if (gen->rest_a) _tone_alarm_cancel(gen->rest_a);
+    _arpeggio_stop(gen);
+    mel->paused = false;
+    mel->index = entry->position;
+    mel->tempo = entry->tempo;
+    mel->deadline_us = time_us_64();
+    gen->playing = true;
+    _melody_step(gen);
+
+    if (offset_us > 0 && offset_us < entry->duration_us) {
+        uint32_t remaining = entry->duration_us - offset_us;
+        _tone_alarm_cancel(gen->melody_a);
+        mel->deadline_us = time_us_64() + remaining;
+        _tone_alarm_set(&gen->melody_a, remaining, _melody_note_complete, gen);
+    } else if (offset_us > 0) { // In the rest that follows the note
+        uint32_t remaining = entry->duration_us + rest_duration * 1000u - offset_us;
+        _tone_alarm_cancel(gen->melody_a);
+        _arpeggio_stop(gen);
+        _backend_enable(gen, false);
+        _backend_commit(gen);
+        mel->phase = MELODY_PHASE_REST;
+        mel->deadline_us = time_us_64() + remaining;
+        _tone_alarm_set(&gen->rest_a, remaining, _rest_complete, gen);
+    }
+
+    if (paused) melody_pause(gen);
+    restore_interrupts(irq_state);
+}
+
+/**
+ * @brief Moves the melody playing to a point in time, in O(log n).
+ * @param gen Pointer to the tone generator structure.
+ * @param entries Index of the melody, from melody_index_build().
+ * @param count Number of entries in the index.
+ * @param time_us Time from the start of the melody (in us).
+ * @return false if the time is past the end of the melody, or no array or table melody is loaded.
+ */
+bool melody_seek(tonegenerator_t *gen, const melody_index_entry_t *entries, uint16_t count, uint32_t time_us){
+    if (gen->mel.source || !gen->mel.notes || count == 0) return false;
+    const melody_index_entry_t *last = &entries[count - 1];
+    if (time_us >= last->start_us + last->duration_us + rest_duration * 1000u) return false;
+
+    uint16_t low = 0, high = count - 1; // Last entry starting at or before time_us
+    while (low < high) {
+        uint16_t mid = (low + high + 1) / 2;
+        if (entries[mid].start_us <= time_us) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    _melody_seek(gen, &entries[low], time_us - entries[low].start_us);
+    return true;
+}
+
+/**
+ * @brief Moves the melody playing to the start of a note, in O(1).
+ * @param gen Pointer to the tone generator structure.
+ * @param entries Index of the melody, from melody_index_build().
+ * @param count Number of entries in the index.
+ * @param note Number of the note, rest or chord (index entry) to move to.
+ * @return false if the note is past the end of the melody, or no array or table melody is loaded.
+ */
+bool melody_seek_note(tonegenerator_t *gen, const melody_index_entry_t *entries, uint16_t count, uint16_t note){
+    if (gen->mel.source || !gen->mel.notes || note >= count) return false;
+    _melody_seek(gen, &entries[note], 0);
+    return true;
 }
 
 /**
@@ -128,68 +774,419 @@ void stop_melody(tonegenerator_t *gen){
  * @param gen Pointer to the tone generator structure.
  * @param freq Frequency value (in Hz).
  */
-void _pwm_set_freq(tonegenerator_t *gen, float freq) {
-    float divider = (float) clock / (freq * 10000.0);
-    pwm_set_clkdiv(gen->slice, divider);
+__force_inline void _pwm_set_freq(tonegenerator_t *gen, float freq) {
+    if (gen->slice_mode == TONE_SLICE_COMPANION) return; // Set by the leader
+    pwm_hw->slice[gen->slice].div = _pwm_prepare_freq(gen, freq);
     pwm_set_wrap(gen->slice, 10000);
-    pwm_set_gpio_level(gen->gpio, 5000);
+}
+
+/**
+ * @brief Precomputes the PWM divider register value for a frequency.
+ * The divider is an 8.4 fixed point number, as written by pwm_set_clkdiv().
+ * Single precision only: doubles are emulated in software on the RP2040.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ * @return Divider register value.
+ */
+__force_inline uint32_t _pwm_prepare_freq(tonegenerator_t *gen, float freq) {
+    float divider = (float) clock / (freq * 10000.0f);
+    uint32_t value = (uint32_t)(divider * 16.0f);
+    return value > 0xFFF ? 0xFFF : value;
+}
+
+/**
+ * @brief Writes a precomputed PWM divider register value.
+ * The wrap value is left untouched, so this is a single register write.
+ * @param gen Pointer to the tone generator structure.
+ * @param value Divider register value.
+ */
+__force_inline void _pwm_apply_freq(tonegenerator_t *gen, uint32_t value) {
+    if (gen->slice_mode == TONE_SLICE_COMPANION) return; // Set by the leader
+    pwm_hw->slice[gen->slice].div = value;
+}
+
+/**
+ * @brief Writes the compare levels of the generator's channels.
+ * In bridge mode, the inverted channel gets a pulse of the same width at the
+ * end of the period, so the duty cycle still sets the volume, and a 50% level
+ * drives the two pins in exact antiphase.
+ * @param gen Pointer to the tone generator structure.
+ * @param level Level, in ten-thousandths of a period.
+ */
+static inline void _pwm_write_level(tonegenerator_t *gen, uint16_t level){
+    pwm_set_chan_level(gen->slice, gen->channel, level);
+    if (gen->slice_mode == TONE_SLICE_BRIDGE) {
+        pwm_set_chan_level(gen->slice, gen->channel ^ 1, 10000 + 1 - level);
+    }
+}
+
+/**
+ * @brief Sets the PWM level.
+ * @param gen Pointer to the tone generator structure.
+ * @param level Level, in ten-thousandths of a period.
+ */
+__force_inline void _pwm_set_level(tonegenerator_t *gen, uint16_t level){
+    if (gen->slice_mode != TONE_SLICE_OWN && !gen->output_enabled) return; // Applied when enabled
+    _pwm_write_level(gen, level);
+}
+
+/**
+ * @brief Starts or stops the PWM slice.
+ * When the slice is shared by two voices, or drives a bridge, it keeps running
+ * and the output is stopped by its levels. This way, the other channel is not
+ * affected, and a bridge is never left with one pin high.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+__force_inline void _pwm_set_enabled(tonegenerator_t *gen, bool enabled){
+    if (gen->slice_mode == TONE_SLICE_OWN) {
+        pwm_set_enabled(gen->slice, enabled);
+        return;
+    }
+    gen->output_enabled = enabled;
+    _pwm_write_level(gen, enabled ? gen->level : 0);
+    if (enabled) pwm_set_enabled(gen->slice, true);
 }
 
 /**
  * @brief Turns on the PWM tone.
+ * The output is not stopped first: backends take a new frequency while running,
+ * which saves a backend call on every note.
  * @param gen Pointer to the tone generator structure.
  * @param freq Frequency value (in Hz).
  */
-void _tone_pwm_on(tonegenerator_t *gen, int freq){
+__force_inline void _tone_pwm_on(tonegenerator_t *gen, int freq){
     if(freq < NOTE_G1) {freq = REST;}
     else if(freq > NOTE_FS9) {freq = REST;}
-    pwm_set_enabled(gen->slice, false);
-    _pwm_set_freq(gen, freq);
-    pwm_set_enabled(gen->slice, true);
+    _backend_set_freq(gen, freq);
+    _backend_set_level(gen, gen->level);
+    _backend_enable(gen, true);
+    _backend_commit(gen);
     gen->playing = true;
 }
 
 /**
- * @brief Steps through the melody.
+ * @brief Turns on the tone at a precomputed backend value.
  * @param gen Pointer to the tone generator structure.
+ * @param value Backend value, as returned by prepare_freq.
  */
-void _melody_step(tonegenerator_t *gen){
-    melody_t mel = gen->mel;
-    note_t note = mel.notes[melody_index];
+__force_inline void _tone_pwm_on_value(tonegenerator_t *gen, uint32_t value){
+    _backend_apply_freq(gen, value);
+    _backend_set_level(gen, gen->level);
+    _backend_enable(gen, true);
+    _backend_commit(gen);
+    gen->playing = true;
+}
 
-    if (note.freq == MELODY_END){
-        melody_index = 0;
-        if(melody_repeat > 0){
-            melody_repeat--;
-        }
-        if(melody_repeat != 0){
-            _melody_step(gen);
+/**
+ * @brief Starts a new tempo segment in the melody.
+ * The duration of a whole note is computed once per segment. During a ramp,
+ * it moves by a fixed step at each note, so notes cost no extra division.
+ * @param mel Pointer to the melody.
+ * @param bpm New tempo (in bpm).
+ * @param notes Number of notes over which the tempo moves to the new value (0 for immediately).
+ */
+void _melody_tempo(melody_t *mel, uint16_t bpm, uint8_t notes){
+    if (bpm == 0) return;
+    if (mel->tempo.bpm == 0 || (!mel->tempo.fixed && mel->tempo.bpm != tempo)) {
+        // Following set_tempo(): ramps start from its current value
+        mel->tempo.bpm = tempo;
+        mel->tempo.whole_note_us = (60000000u * 4) / tempo;
+    }
+    uint32_t whole_note_us = (60000000u * 4) / bpm;
+    if (notes > 0) {
+        mel->tempo.ramp_step_us = ((int32_t) whole_note_us - (int32_t) mel->tempo.whole_note_us) / notes;
+        mel->tempo.ramp_notes = notes;
+    } else {
+        mel->tempo.whole_note_us = whole_note_us;
+        mel->tempo.ramp_notes = 0;
+    }
+    mel->tempo.bpm = bpm;
+    mel->tempo.fixed = true;
+}
+
+/**
+ * @brief Computes the duration of the next note, at the current tempo.
+ * @param mel Pointer to the melody.
+ * @param measure Measure of the note (negative for dotted notes).
+ * @return Duration (in us), 0 for a measure of 0.
+ */
+static inline uint32_t _note_duration(melody_t *mel, int8_t measure){
+    if (measure == 0) return 0; // Malformed, takes no time and no step of a ramp
+    if (mel->tempo.ramp_notes > 0) {
+        if (--mel->tempo.ramp_notes == 0) {
+            mel->tempo.whole_note_us = (60000000u * 4) / mel->tempo.bpm; // Land exactly on the target
         } else {
-            gen->playing = false;
+            mel->tempo.whole_note_us += mel->tempo.ramp_step_us;
+        }
+    } else if (!mel->tempo.fixed && mel->tempo.bpm != tempo) {
+        // Following set_tempo(), which has changed
+        mel->tempo.bpm = tempo;
+        mel->tempo.whole_note_us = (60000000u * 4) / tempo;
+    }
+    uint32_t duration = mel->tempo.whole_note_us / abs(measure);
+    if (measure < 0) { // Dotted note
+        duration += duration / 2;
+    }
+    return duration;
+}
+
+/**
+ * @brief Reads an event ahead in the melody, without consuming it.
+ * @param mel Pointer to the melody.
+ * @param offset Position of the event, relative to the next one.
+ * @param note Pointer to the event to fill.
+ * @return false if a streamed melody has not prefetched the event yet.
+ */
+static inline bool _melody_peek(melody_t *mel, uint16_t offset, note_t *note){
+    if (mel->notes) { // Arrays and tables, the common case, tested first
+        *note = mel->notes[mel->index + offset];
+        return true;
+    }
+    if (mel->code) { // Decode ahead from a copy of the state
+        melody_code_state_t state = mel->code_state;
+        for (uint16_t i = 0; i <= offset; i++) {
+            _melody_code_next(mel->code, &state, note);
         }
-        
+        return true;
+    }
+    uint16_t available = (mel->head + mel->size - mel->tail) % mel->size;
+    if (offset >= available) return false;
+    __dmb();
+    *note = mel->buffer[(mel->tail + offset) % mel->size];
+    return true;
+}
+
+/**
+ * @brief Consumes events of the melody.
+ * @param mel Pointer to the melody.
+ * @param count Number of events.
+ */
+static inline void _melody_advance(melody_t *mel, uint16_t count){
+    if (mel->notes) {
+        mel->index += count;
+    } else if (mel->code) {
+        note_t note;
+        for (uint16_t i = 0; i < count; i++) {
+            _melody_code_next(mel->code, &mel->code_state, &note);
+        }
+    } else {
+        mel->tail = (mel->tail + count) % mel->size;
+    }
+}
+
+/**
+ * @brief Goes back to the start of the melody, after its MELODY_END event.
+ * Streamed melodies only skip the event: melody_stream_refill() has already
+ * rewound the source and buffered the next pass after it.
+ * Each pass starts at the tempo the melody started with, as in melody().
+ * @param gen Pointer to the tone generator structure.
+ * @return false if the melody cannot be repeated.
+ */
+static inline bool _melody_rewind(tonegenerator_t *gen){
+    melody_t *mel = &gen->mel;
+    mel->tempo = (melody_tempo_t){0};
+    if (gen->tempo) _melody_tempo(mel, gen->tempo, 0);
+    if (mel->code) {
+        mel->code_state.pc = mel->code_entry;
+        mel->code_state.depth = 0;
+        return true;
+    }
+    if (!mel->source) {
+        mel->index = 0;
+        return true;
+    }
+    _melody_advance(mel, 1);
+    return mel->source->rewind != NULL;
+}
+
+/**
+ * @brief Plays the next event of the melody, a note or a rest.
+ * @param gen Pointer to the tone generator structure.
+ * @param note The event, already read with _melody_peek().
+ */
+static __force_inline void _melody_note(tonegenerator_t *gen, note_t note){
+    melody_t *mel = &gen->mel;
+    if (mel->durations){ // Precomputed by the C++ melody builder
+        uint16_t i = mel->index;
+        _melody_advance(mel, 1);
+        _melody_tone(gen, note.freq, mel->freq_values ? mel->freq_values[i] : 0, mel->durations[i]);
     } else {
-        int8_t measure = note.measure;
-        int whole_note = (60000 * 4) / tempo;
-        int duration = whole_note / abs(measure);
-        if (measure < 0) { // Dotted note
-            duration *= 1.5;
+        _melody_advance(mel, 1);
+        _melody_tone(gen, note.freq, 0, _note_duration(mel, note.measure));
+    }
+}
+
+/**
+ * @brief Handles a control event of the melody: its end, a chord, a tempo change or a marker.
+ * @param gen Pointer to the tone generator structure.
+ * @param note The event, already read with _melody_peek().
+ * @return true if the event took no time, and the next one must be played now.
+ */
+static inline bool _melody_control(tonegenerator_t *gen, note_t note){
+    melody_t *mel = &gen->mel;
+    if (note.freq == MELODY_END){
+        if(mel->repeat > 0){
+            mel->repeat--;
+        }
+        if(mel->repeat != 0 && _melody_rewind(gen)){
+            return true;
+        }
+        gen->playing = false;
+        return false;
+    }
+    if (note.freq == CHORD){
+        uint8_t count = note.measure;
+        if (count == 0) { // Empty. Streams never get here with a chord larger than their ring
+            _melody_advance(mel, 1);
+            return true;
+        }
+        note_t chord[TONE_ARPEGGIO_MAX];
+        uint8_t n = count < TONE_ARPEGGIO_MAX ? count : TONE_ARPEGGIO_MAX;
+        if (mel->code) { // Decoded once, in order, as peeking would decode from the chord each time
+            _melody_advance(mel, 1);
+            for (uint8_t i = 0; i < count; i++) {
+                _melody_code_next(mel->code, &mel->code_state, i < n ? &chord[i] : &note);
+            }
+            _melody_chord(gen, chord, n, _note_duration(mel, chord[0].measure));
+            return false;
         }
-        _melody_tone(gen, note.freq, duration);
-        melody_index++;
+        if (!_melody_peek(mel, count, &note)) {
+            _melody_underrun(gen);
+            return false;
+        }
+        for (uint8_t i = 0; i < n; i++) {
+            _melody_peek(mel, i + 1, &chord[i]);
+        }
+        uint32_t duration = mel->durations ? mel->durations[mel->index] : _note_duration(mel, chord[0].measure);
+        _melody_advance(mel, count + 1);
+        _melody_chord(gen, chord, n, duration);
+        return false;
+    }
+    if (note.freq == TEMPO){
+        _melody_advance(mel, 1);
+        _melody_tempo(mel, note.arg, note.measure);
+        return true;
+    }
+    if (note.freq == MARKER){
+        _melody_advance(mel, 1);
+        // Markers take no time: the previous phase is over, and if the callback
+        // pauses the melody, resuming goes straight to the next note
+        mel->phase = MELODY_PHASE_REST;
+        _tone_marker_dispatch(gen, note.arg, mel->deadline_us);
+        return gen->playing && !mel->paused;
+    }
+    // Unknown events are played as notes, out of range and so silent
+    _melody_note(gen, note);
+    return false;
+}
+
+/**
+ * @brief Handles control events until the next note or rest.
+ * Events that take no time are followed by the next one in a loop, so that any
+ * number of them runs in constant stack, in interrupt context. Kept out of
+ * _melody_step(), so that notes and rests do not pay for its stack frame.
+ * @param gen Pointer to the tone generator structure.
+ * @param note The event, already read with _melody_peek(). Set to the next note or rest.
+ * @return true if the note or rest in note must be played now.
+ */
+static __noinline bool _melody_controls(tonegenerator_t *gen, note_t *note){
+    melody_t *mel = &gen->mel;
+    bool rewound = false;
+
+    do {
+        if (note->freq == MELODY_END) {
+            if (rewound) { // A whole pass with nothing to play: stop, rather than loop here
+                gen->playing = false;
+                return false;
+            }
+            rewound = true;
+        }
+        if (!_melody_control(gen, *note)) return false;
+        if (!_melody_peek(mel, 0, note)) {
+            _melody_underrun(gen);
+            return false;
+        }
+    } while (note->freq < REST);
+    return true;
+}
+
+/**
+ * @brief Steps through the melody.
+ * @param gen Pointer to the tone generator structure.
+ */
+void _melody_step(tonegenerator_t *gen){
+    melody_t *mel = &gen->mel;
+    note_t note;
+
+    if (!_melody_peek(mel, 0, &note)) {
+        _melody_underrun(gen);
+        return;
     }
+    if (note.freq < REST && !_melody_controls(gen, &note)) return;
+    _melody_note(gen, note);
+}
+
+/**
+ * @brief Waits for a streamed melody whose buffer is empty, with the output off.
+ * @param gen Pointer to the tone generator structure.
+ */
+static void _melody_underrun(tonegenerator_t *gen){
+    gen->mel.underruns++;
+    gen->mel.phase = MELODY_PHASE_REST;
+    gen->mel.deadline_us = time_us_64() + PWM_TONE_STREAM_RETRY_US;
+    _backend_enable(gen, false);
+    _backend_commit(gen);
+    if (gen->rest_a) _tone_alarm_cancel(gen->rest_a);
+    _tone_alarm_set(&gen->rest_a, PWM_TONE_STREAM_RETRY_US, _rest_complete, gen);
 }
 
 /**
- * @brief Plays a single note in the melody.
+ * @brief Plays a single note in the melody, stopping the arpeggio of a previous chord.
  * @param gen Pointer to the tone generator structure.
  * @param freq Frequency of the note (in Hz).
- * @param duration Duration of the note (in ms).
+ * @param value Precomputed backend value for the frequency, or 0 to compute it.
+ * @param duration Duration of the note (in us).
+ */
+__force_inline void _melody_tone(tonegenerator_t *gen, int freq, uint32_t value, uint32_t duration) {
+    _arpeggio_stop(gen);
+    if(freq != REST){
+        if(value){ _tone_pwm_on_value(gen, value); }
+        else { _tone_pwm_on(gen, freq); }
+    }
+    gen->mel.phase = MELODY_PHASE_NOTE;
+    gen->mel.freq = freq;
+    gen->mel.deadline_us = time_us_64() + duration;
+    _tone_alarm_cancel(gen->melody_a);
+    _tone_alarm_set(&gen->melody_a, duration, _melody_note_complete, gen);
+}
+
+/**
+ * @brief Plays a chord as a fast arpeggio.
+ * The backend values of all the chord notes are computed here, so that
+ * each arpeggio step is a single precomputed register write.
+ * @param gen Pointer to the tone generator structure.
+ * @param notes Notes making up the chord.
+ * @param count Number of notes in the chord.
+ * @param duration Duration of the chord (in us).
  */
-void _melody_tone(tonegenerator_t *gen, int freq, uint16_t duration) {
-    if(freq != REST){ _tone_pwm_on(gen, freq); }
-    if (melody_a) cancel_alarm(melody_a);
-    melody_a = add_alarm_in_ms(duration, _melody_note_complete, gen, true);
+void _melody_chord(tonegenerator_t *gen, note_t *notes, uint8_t count, uint32_t duration) {
+    float first = REST;
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < count && n < TONE_ARPEGGIO_MAX; i++) {
+        float freq = notes[i].freq;
+        if (freq < NOTE_G1 || freq > NOTE_FS9) continue;
+        if (n == 0) first = freq;
+        gen->arp_values[n++] = _backend_prepare_freq(gen, freq);
+    }
+
+    _melody_tone(gen, first, 0, duration);
+    if (duration == 0) return; // Already over
+    gen->arp_count = n;
+    gen->arp_step = 0;
+    if (n > 1 && arpeggio_interval > 0) {
+        _tone_alarm_set(&gen->arp_a, arpeggio_interval * 1000ull, _arpeggio_step, gen);
+    }
 }
 
 /**
@@ -199,9 +1196,12 @@ void _melody_tone(tonegenerator_t *gen, int freq, uint16_t duration) {
  * @return 0 on success.
  */
 static int64_t _tone_complete(alarm_id_t id, void *user_data) {
+    _PROFILE_BEGIN(TONE_PROFILE_TONE_COMPLETE);
     tonegenerator_t *gen = (tonegenerator_t*) user_data;
-    pwm_set_enabled(gen->slice, false);
+    _backend_enable(gen, false);
+    _backend_commit(gen);
     gen->playing = false;
+    _PROFILE_END(TONE_PROFILE_TONE_COMPLETE);
     return 0;
 }
 
@@ -212,15 +1212,21 @@ static int64_t _tone_complete(alarm_id_t id, void *user_data) {
  * @return 0 on success.
  */
 static int64_t _melody_note_complete(alarm_id_t id, void *user_data) {
+    _PROFILE_BEGIN(TONE_PROFILE_NOTE_COMPLETE);
     tonegenerator_t *gen = (tonegenerator_t*) user_data;
-    pwm_set_enabled(gen->slice, false);
+    _arpeggio_stop(gen);
+    _backend_enable(gen, false);
+    _backend_commit(gen);
 
     if(rest_duration > 0){
-        if (rest_a) cancel_alarm(rest_a);
-        rest_a = add_alarm_in_ms(rest_duration, _rest_complete, user_data, true);
+        gen->mel.phase = MELODY_PHASE_REST;
+        gen->mel.deadline_us = time_us_64() + rest_duration * 1000ull;
+        if (gen->rest_a) _tone_alarm_cancel(gen->rest_a);
+        _tone_alarm_set(&gen->rest_a, rest_duration * 1000ull, _rest_complete, gen);
     } else {
         _melody_step(user_data);
     }
+    _PROFILE_END(TONE_PROFILE_NOTE_COMPLETE);
     return 0;
 }
 
@@ -231,7 +1237,25 @@ static int64_t _melody_note_complete(alarm_id_t id, void *user_data) {
  * @return 0 on success.
  */
 static int64_t _rest_complete(alarm_id_t id, void *user_data) {
+    _PROFILE_BEGIN(TONE_PROFILE_REST_COMPLETE);
     _melody_step(user_data);
+    _PROFILE_END(TONE_PROFILE_REST_COMPLETE);
     return 0;
 }
 
+/**
+ * @brief Callback for the arpeggio steps.
+ * Rescheduled relative to its previous deadline, so the rate does not drift.
+ * @param id Alarm ID.
+ * @param user_data Pointer to the tone generator structure.
+ * @return Negative interval to the next step (in us).
+ */
+static int64_t _arpeggio_step(alarm_id_t id, void *user_data) {
+    _PROFILE_BEGIN(TONE_PROFILE_ARPEGGIO_STEP);
+    tonegenerator_t *gen = (tonegenerator_t*) user_data;
+    if (++gen->arp_step >= gen->arp_count) gen->arp_step = 0;
+    _backend_apply_freq(gen, gen->arp_values[gen->arp_step]);
+    _backend_commit(gen);
+    _PROFILE_END(TONE_PROFILE_ARPEGGIO_STEP);
+    return -(int64_t) arpeggio_interval * 1000;
+}
@@ -16,6 +16,76 @@
 extern "C" {
 #endif
 
+/**
+ * @def PWM_TONE_PWM_ONLY
+ * @brief When set to 1, generators can only be driven by PWM and backend calls
+ * are resolved at compile time, with no indirection.
+ */
+#ifndef PWM_TONE_PWM_ONLY
+#define PWM_TONE_PWM_ONLY 0
+#endif
+
+/**
+ * @def TONE_LEVEL_DEFAULT
+ * @brief Default output level, in ten-thousandths of a period (50% duty cycle).
+ */
+#define TONE_LEVEL_DEFAULT 5000
+
+/**
+ * @def TONE_ARPEGGIO_MAX
+ * @brief Maximum number of notes in a chord.
+ */
+#define TONE_ARPEGGIO_MAX 4
+
+/**
+ * @def PWM_TONE_MAX_VOICES
+ * @brief Number of generators playing at once that the dedicated timer pool is sized for:
+ * one per PWM slice and one per PIO state machine. Companion voices count as generators too.
+ */
+#ifndef PWM_TONE_MAX_VOICES
+#define PWM_TONE_MAX_VOICES 16
+#endif
+
+/**
+ * @def PWM_TONE_TIMER_EVENTS_PER_VOICE
+ * @brief Number of events a generator can have pending at once: the end of a tone()
+ * (tone_a), the end of a melody note or rest (melody_a or rest_a), and the arpeggio of a chord (arp_a).
+ */
+#define PWM_TONE_TIMER_EVENTS_PER_VOICE 3
+
+/**
+ * @def PWM_TONE_TIMER_POOL_SIZE
+ * @brief Number of events in the dedicated timer pool (see tone_timer_init()).
+ * Maximum 255. When the pool is full, the generator that could not schedule an event is stopped.
+ */
+#ifndef PWM_TONE_TIMER_POOL_SIZE
+#define PWM_TONE_TIMER_POOL_SIZE (PWM_TONE_MAX_VOICES * PWM_TONE_TIMER_EVENTS_PER_VOICE)
+#endif
+
+/**
+ * @def PWM_TONE_STREAM_RETRY_US
+ * @brief Delay before the scheduler looks again at an empty stream buffer (in us).
+ */
+#ifndef PWM_TONE_STREAM_RETRY_US
+#define PWM_TONE_STREAM_RETRY_US 1000
+#endif
+
+/**
+ * @def PWM_TONE_MARKER_QUEUE_SIZE
+ * @brief Number of markers the queue read by tone_marker_poll() can hold. Must be a power of 2.
+ */
+#ifndef PWM_TONE_MARKER_QUEUE_SIZE
+#define PWM_TONE_MARKER_QUEUE_SIZE 16
+#endif
+
+/**
+ * @def MELODY_CODE_DEPTH
+ * @brief Maximum nesting of repeated blocks and subroutine calls in melody bytecode.
+ */
+#ifndef MELODY_CODE_DEPTH
+#define MELODY_CODE_DEPTH 4
+#endif
+
 /**
  * @struct note_t
  * @brief Represents a musical note.
@@ -23,28 +93,267 @@ extern "C" {
 typedef struct note_t {
     float freq; /**< Frequency of the note (in Hz). */
     int8_t measure; /**< Measure of the note (in subdivisions of a whole note). */
+    int16_t arg; /**< Argument of control events, such as the bpm of TEMPO (0 for notes). */
 } note_t;
 
+/**
+ * @struct melody_source_t
+ * @brief Source of melody events, pulled in small batches by melody_stream_refill().
+ * Its functions are never called from interrupt context.
+ */
+typedef struct melody_source_t {
+    uint16_t (*read)(void *context, note_t *notes, uint16_t max); /**< Writes up to max events, returns how many (0 at the end). */
+    void (*rewind)(void *context); /**< Restarts from the first event (optional, needed for repeats). */
+    void *context; /**< Argument for the functions above. */
+} melody_source_t;
+
+/**
+ * @brief Opcodes of the melody bytecode played by melody_code().
+ * Bytes 0 to 127 play the MIDI note of that number, and are followed by the measure.
+ * Multi-byte arguments are little endian.
+ */
+enum {
+    MELODY_OP_END = 0x80, /**< End of the melody. */
+    MELODY_OP_REST, /**< Rest. Argument: measure. */
+    MELODY_OP_FREQ, /**< Note of any frequency. Arguments: frequency (in Hz, 16 bits), measure. */
+    MELODY_OP_CHORD, /**< Chord. Argument: number of notes that follow. */
+    MELODY_OP_TEMPO, /**< Tempo change. Arguments: ramp notes, bpm (16 bits). */
+    MELODY_OP_MARKER, /**< Marker. Argument: ID (16 bits). */
+    MELODY_OP_REPEAT, /**< Start of a repeated block. Argument: number of times the block is played. */
+    MELODY_OP_LOOP, /**< End of a repeated block. */
+    MELODY_OP_CALL, /**< Subroutine call. Argument: address (16 bits). */
+    MELODY_OP_RET, /**< Return from a subroutine. */
+};
+
+/**
+ * @struct melody_code_state_t
+ * @brief Decoder state of a melody played from bytecode.
+ */
+typedef struct melody_code_state_t {
+    uint16_t pc; /**< Address of the next opcode. */
+    uint16_t size; /**< Size of the bytecode (in bytes). Decoding ends at an opcode that does not fit in it. */
+    uint8_t depth; /**< Number of open repeated blocks and subroutine calls. */
+    uint8_t count[MELODY_CODE_DEPTH]; /**< Times left to play each repeated block (0 for calls). */
+    uint16_t address[MELODY_CODE_DEPTH]; /**< Start of each repeated block, or return address of each call. */
+} melody_code_state_t;
+
+/**
+ * @struct melody_tempo_t
+ * @brief Tempo state of a melody.
+ */
+typedef struct melody_tempo_t {
+    bool fixed; /**< Whether the melody has its own tempo, instead of following set_tempo(). */
+    uint8_t ramp_notes; /**< Notes left in the current tempo ramp. */
+    uint16_t bpm; /**< Tempo of the current tempo segment, or target of the current ramp (in bpm). */
+    uint32_t whole_note_us; /**< Duration of a whole note at the current tempo (in us). */
+    int32_t ramp_step_us; /**< Change of whole_note_us at each note of a tempo ramp (in us). */
+} melody_tempo_t;
+
+/**
+ * @brief Phases of a playing melody.
+ */
+enum {
+    MELODY_PHASE_NOTE = 0, /**< A note is playing. */
+    MELODY_PHASE_REST, /**< Silence between notes. */
+};
+
 /**
  * @struct melody_t
  * @brief Represents a musical melody.
  */
 typedef struct melody_t {     
     bool playing; /**< Flag indicating whether the melody is playing. */
-    note_t * notes; /**< Array of notes in the melody. */
+    const note_t * notes; /**< Array of notes in the melody. */
+    uint16_t index; /**< Index of the next note to play. */
+    uint16_t repeat; /**< Remaining number of repetitions. */
+    const melody_source_t *source; /**< Streaming source (NULL when playing an array). */
+    note_t *buffer; /**< Ring buffer of prefetched events (streaming only). */
+    uint16_t size; /**< Number of events in the ring buffer. */
+    volatile uint16_t head; /**< Next slot written by melody_stream_refill(). */
+    volatile uint16_t tail; /**< Next slot read by the scheduler. */
+    volatile bool eof; /**< Whether the source has reached the end of the melody. */
+    uint16_t source_repeat; /**< Remaining number of times the source is rewound, counted like repeat. */
+    uint8_t skip; /**< Notes left to drop, of a chord too large for the ring buffer. */
+    uint16_t underruns; /**< Number of times the scheduler found the buffer empty. */
+    melody_tempo_t tempo; /**< Tempo state. */
+    bool paused; /**< Whether the melody is paused. */
+    uint8_t phase; /**< Whether a note (MELODY_PHASE_NOTE) or a rest between notes (MELODY_PHASE_REST) is playing. */
+    float freq; /**< Frequency of the note playing (in Hz). */
+    uint64_t deadline_us; /**< Time the current phase ends (in us since boot). */
+    uint32_t remaining_us; /**< Time left in the current phase when paused (in us). */
+    const uint32_t *durations; /**< Precomputed duration of each event (in us), or NULL. */
+    const uint32_t *freq_values; /**< Precomputed backend value of each note, or NULL. */
+    const uint8_t *code; /**< Bytecode of the melody (NULL when playing notes). */
+    uint16_t code_entry; /**< Address of the first opcode of the melody. */
+    melody_code_state_t code_state; /**< Bytecode decoder state. */
 } melody_t;
 
+/**
+ * @struct melody_table_t
+ * @brief Melody with precomputed timing and register values, as built at compile time
+ * by the C++ melody builder (pwm-tone.hpp). All arrays are indexed by event position.
+ */
+typedef struct melody_table_t {
+    const note_t *notes; /**< Array of notes, terminated by MELODY_END. */
+    const uint32_t *duration_us; /**< Duration of each note, rest and chord (in us). */
+    const uint32_t *freq_values; /**< PWM divider register value of each note (0 for other events). */
+    uint32_t clock_hz; /**< System clock the divider values were computed for (in Hz). */
+} melody_table_t;
+
+/**
+ * @struct melody_index_entry_t
+ * @brief Entry of a seek index, built by melody_index_build().
+ */
+typedef struct melody_index_entry_t {
+    uint32_t start_us; /**< Start time of the event, from the start of the melody (in us). */
+    uint32_t duration_us; /**< Duration of the event, without the rest that follows it (in us). */
+    uint16_t position; /**< Position of the event in the note array. */
+    melody_tempo_t tempo; /**< Tempo state before the event. */
+} melody_index_entry_t;
+
+/**
+ * @def PWM_TONE_PROFILE
+ * @brief When set to 1, the library reports the time spent in its interrupt
+ * callbacks through pwm_tone_profile_begin() and pwm_tone_profile_end(),
+ * which must then be provided by the application.
+ */
+#ifndef PWM_TONE_PROFILE
+#define PWM_TONE_PROFILE 0
+#endif
+
+#if PWM_TONE_PROFILE
+/**
+ * @brief Operations reported to the profiling hooks.
+ */
+enum {
+    TONE_PROFILE_TONE_COMPLETE = 0, /**< _tone_complete() alarm callback. */
+    TONE_PROFILE_NOTE_COMPLETE, /**< _melody_note_complete() alarm callback. */
+    TONE_PROFILE_REST_COMPLETE, /**< _rest_complete() alarm callback. */
+    TONE_PROFILE_ARPEGGIO_STEP, /**< _arpeggio_step() alarm callback. */
+    TONE_PROFILE_NOISE_SAMPLE, /**< Noise PWM wrap interrupt handler. */
+    TONE_PROFILE_MARKER, /**< Marker dispatch, including the marker callback. */
+    TONE_PROFILE_COUNT,
+};
+
+/**
+ * @brief Called when a profiled operation starts. Provided by the application.
+ * @param op Operation (TONE_PROFILE_*).
+ */
+void pwm_tone_profile_begin(uint8_t op);
+
+/**
+ * @brief Called when a profiled operation ends. Provided by the application.
+ * @param op Operation (TONE_PROFILE_*).
+ */
+void pwm_tone_profile_end(uint8_t op);
+
+#define _PROFILE_BEGIN(op) pwm_tone_profile_begin(op)
+#define _PROFILE_END(op) pwm_tone_profile_end(op)
+#else
+#define _PROFILE_BEGIN(op)
+#define _PROFILE_END(op)
+#endif
+
+typedef struct tonegenerator_t tonegenerator_t;
+
+/**
+ * @struct tone_backend_t
+ * @brief Output backend driven by the sequencer.
+ * Optional operations can be left NULL.
+ */
+typedef struct tone_backend_t {
+    void (*set_freq)(tonegenerator_t *gen, float freq); /**< Sets the output frequency (in Hz), also while the output runs. */
+    void (*set_level)(tonegenerator_t *gen, uint16_t level); /**< Sets the output level (optional). */
+    void (*enable)(tonegenerator_t *gen, bool enabled); /**< Starts or stops the output. */
+    void (*commit)(tonegenerator_t *gen); /**< Applies the pending changes (optional). */
+    uint32_t (*prepare_freq)(tonegenerator_t *gen, float freq); /**< Precomputes the register value for a frequency (optional). */
+    void (*apply_freq)(tonegenerator_t *gen, uint32_t value); /**< Applies a value returned by prepare_freq (optional). */
+} tone_backend_t;
+
+/**
+ * @brief Marker callback, called from the scheduler interrupt when a MARKER event is reached.
+ * @param gen Tone generator playing the melody.
+ * @param id Marker ID.
+ * @param user_data Argument given to tone_set_marker_callback().
+ */
+typedef void (*tone_marker_callback_t)(tonegenerator_t *gen, int16_t id, void *user_data);
+
+/**
+ * @struct tone_marker_t
+ * @brief Marker reached by a melody, as read by tone_marker_poll().
+ */
+typedef struct tone_marker_t {
+    tonegenerator_t *gen; /**< Tone generator playing the melody. */
+    int16_t id; /**< Marker ID. */
+    uint64_t time_us; /**< Time the marker was scheduled for (in us since boot). */
+} tone_marker_t;
+
+/**
+ * @struct tone_marker_stats_t
+ * @brief Dispatch statistics of the markers.
+ */
+typedef struct tone_marker_stats_t {
+    uint32_t dispatched; /**< Number of markers dispatched. */
+    uint32_t dropped; /**< Number of markers lost because the queue was full. */
+    uint32_t latency_max_us; /**< Longest delay between the scheduled time and the dispatch (in us). */
+    uint32_t handler_max_us; /**< Longest time spent in a marker callback (in us). */
+} tone_marker_stats_t;
+
+/**
+ * @brief PWM backend. One PWM slice per generator.
+ */
+extern const tone_backend_t tone_backend_pwm;
+
+#if !PWM_TONE_PWM_ONLY
+/**
+ * @brief PIO backend. One PIO state machine per generator.
+ */
+extern const tone_backend_t tone_backend_pio;
+
+/**
+ * @brief Noise backend. One PWM slice per generator, clocking an LFSR.
+ */
+extern const tone_backend_t tone_backend_noise;
+#endif
+
+/**
+ * @brief How a PWM generator uses its slice.
+ */
+enum {
+    TONE_SLICE_OWN = 0, /**< The generator is the only user of the slice. */
+    TONE_SLICE_SHARED, /**< The generator sets the frequency of a slice shared with a companion. */
+    TONE_SLICE_COMPANION, /**< The generator follows the frequency of the other channel, with its own level. */
+    TONE_SLICE_BRIDGE, /**< The generator drives both channels in antiphase (bridge mode). */
+};
+
 /**
  * @struct tonegenerator_t
  * @brief Represents a tone generator.
  */
-typedef struct tonegenerator_t {
+struct tonegenerator_t {
     bool playing; /**< Flag indicating whether the tone generator is playing. */
     uint8_t gpio; /**< GPIO pin number for the tone generator. */
     uint8_t slice; /**< PWM slice number for the tone generator. */
     uint8_t channel; /**< PWM channel number for the tone generator. */
+    uint8_t slice_mode; /**< How the generator uses its PWM slice (TONE_SLICE_*). */
+    bool output_enabled; /**< Whether the output is on, when stopped by level rather than by stopping the slice. */
     melody_t mel; /**< Melody being played by the tone generator. */
-} tonegenerator_t;
+    const tone_backend_t *backend; /**< Output backend driving the tone generator. */
+    void *backend_data; /**< Context for custom backends. */
+    uint16_t level; /**< Output level, in ten-thousandths of a period. */
+    uint16_t tempo; /**< Tempo of the melodies played by the generator (in bpm, 0 to follow set_tempo()). */
+    uint8_t pio; /**< PIO block index (PIO backend only). */
+    uint8_t sm; /**< PIO state machine number (PIO backend only). */
+    alarm_id_t tone_a; /**< Alarm ID of the pending tone() completion. */
+    alarm_id_t melody_a; /**< Alarm ID of the pending melody note completion. */
+    alarm_id_t rest_a; /**< Alarm ID of the pending rest completion. */
+    alarm_id_t arp_a; /**< Alarm ID of the running arpeggio. */
+    uint8_t arp_count; /**< Number of notes in the current chord. */
+    uint8_t arp_step; /**< Chord note currently playing. */
+    uint32_t arp_values[TONE_ARPEGGIO_MAX]; /**< Precomputed backend values for the chord notes. */
+    tone_marker_callback_t marker_cb; /**< Marker callback (NULL to queue markers for tone_marker_poll()). */
+    void *marker_data; /**< Argument for the marker callback. */
+};
 
 /**
  * @brief Initializes the tone generator.
@@ -53,6 +362,153 @@ typedef struct tonegenerator_t {
  */
 void tone_init(tonegenerator_t *gen, uint8_t gpio);
 
+/**
+ * @brief Initializes a tone generator in bridge mode, driving a speaker or piezo
+ * connected between two pins in antiphase, for twice the voltage swing.
+ * The second pin is the inverted output of the same PWM slice, so the bridge
+ * costs no CPU per cycle. The level still sets the volume.
+ * @param gen Pointer to the tone generator structure.
+ * @param gpio GPIO pin number for the first terminal.
+ * @param gpio_inverted GPIO pin number for the second terminal, on the other channel of the same PWM slice.
+ * @return false if the pins are not the two channels of one PWM slice.
+ */
+bool tone_init_bridge(tonegenerator_t *gen, uint8_t gpio, uint8_t gpio_inverted);
+
+/**
+ * @brief Takes a tone generator out of bridge mode, undoing tone_init_bridge().
+ * The output is stopped, and the slice is left stopped with both pins low and
+ * its polarity restored, so the pins can be used for something else.
+ * @param gen Pointer to the tone generator structure.
+ */
+void tone_deinit_bridge(tonegenerator_t *gen);
+
+#if !PWM_TONE_PWM_ONLY
+/**
+ * @brief Initializes a tone generator driven by a PIO state machine.
+ * The square wave is generated by PIO from a half-period counter, so the
+ * generator does not use a PWM slice. Up to 8 generators (4 per PIO block)
+ * can be created this way, in addition to the PWM ones.
+ * @param gen Pointer to the tone generator structure.
+ * @param gpio GPIO pin number for the tone generator.
+ * @return true on success, false if no PIO state machine or program space is free.
+ */
+bool tone_init_pio(tonegenerator_t *gen, uint8_t gpio);
+
+/**
+ * @brief Initializes a noise generator, for percussion and static effects.
+ * The output is driven by an LFSR clocked by the PWM wrap interrupt. When playing
+ * tones and melodies, the note frequency sets the LFSR clock rate (in Hz).
+ * @param gen Pointer to the tone generator structure.
+ * @param gpio GPIO pin number for the tone generator.
+ */
+void tone_init_noise(tonegenerator_t *gen, uint8_t gpio);
+
+/**
+ * @brief Initializes a tone generator driven by a custom backend,
+ * such as an I2S DAC or a WAV file sink.
+ * @param gen Pointer to the tone generator structure.
+ * @param backend Backend operations.
+ * @param data Context made available to the backend as gen->backend_data.
+ */
+void tone_init_backend(tonegenerator_t *gen, const tone_backend_t *backend, void *data);
+#endif
+
+/**
+ * @struct tone_timer_stats_t
+ * @brief Occupancy statistics of the dedicated timer pool.
+ */
+typedef struct tone_timer_stats_t {
+    uint8_t size; /**< Number of events in the pool (0 if the default alarm pool is used). */
+    uint8_t used; /**< Number of events currently scheduled. */
+    uint8_t peak; /**< Highest number of events scheduled at once. */
+    uint32_t overflows; /**< Number of events that could not be scheduled because the pool was full. */
+} tone_timer_stats_t;
+
+/**
+ * @brief Makes the library use a dedicated hardware alarm and a statically
+ * allocated event pool, instead of the SDK's default alarm pool.
+ * Must be called before anything is played.
+ * @param alarm_num Hardware alarm number (0-3), or -1 to claim an unused one.
+ * @return true on success, false if no hardware alarm is available.
+ */
+bool tone_timer_init(int alarm_num);
+
+/**
+ * @brief Reads the occupancy statistics of the dedicated timer pool.
+ * @param stats Pointer to the structure to fill.
+ */
+void tone_timer_get_stats(tone_timer_stats_t *stats);
+
+/**
+ * @brief Adds GPIO pins to the budget used by the voice allocator.
+ * @param gpio_mask Mask of the GPIO pins (bit n for GPIO n).
+ */
+void tone_alloc_add_pins(uint32_t gpio_mask);
+
+/**
+ * @brief Keeps a PWM slice away from the voice allocator, for example for motor control.
+ * @param slice PWM slice number.
+ * @return false if the slice is already used by a voice.
+ */
+bool tone_alloc_reserve_slice(uint8_t slice);
+
+/**
+ * @brief Initializes a tone generator on a pin of the budget whose PWM slice is unused,
+ * so that it can play any pitch without affecting other voices.
+ * @param gen Pointer to the tone generator structure.
+ * @return false if no pin on a free slice is left.
+ */
+bool tone_alloc_voice(tonegenerator_t *gen);
+
+/**
+ * @brief Initializes a companion of a voice, on the other channel of its PWM slice.
+ * The two channels of a slice share one counter, so the companion always plays
+ * at the pitch of the leader: its notes only set when it sounds, and its level.
+ * This suits unison doubling and duty cycle (timbre or volume) effects.
+ * @param gen Pointer to the tone generator structure.
+ * @param leader Voice allocated with tone_alloc_voice().
+ * @return false if the other channel of the slice is not in the budget or is used.
+ */
+bool tone_alloc_companion(tonegenerator_t *gen, tonegenerator_t *leader);
+
+/**
+ * @brief Initializes a tone generator in bridge mode (see tone_init_bridge()),
+ * on both channels of a PWM slice whose pins are in the budget.
+ * @param gen Pointer to the tone generator structure.
+ * @return false if no free slice has both pins in the budget.
+ */
+bool tone_alloc_bridge(tonegenerator_t *gen);
+
+/**
+ * @brief Stops a voice and returns its pin to the allocator.
+ * Freeing a leader also frees its companion.
+ * @param gen Pointer to the tone generator structure.
+ */
+void tone_alloc_free(tonegenerator_t *gen);
+
+/**
+ * @brief Sets the function called when a melody reaches a MARKER event.
+ * The callback runs in the scheduler interrupt, before the next note starts,
+ * so it must be short. Without a callback, markers are queued for tone_marker_poll().
+ * @param gen Pointer to the tone generator structure.
+ * @param callback Marker callback, or NULL to queue markers.
+ * @param user_data Argument for the callback.
+ */
+void tone_set_marker_callback(tonegenerator_t *gen, tone_marker_callback_t callback, void *user_data);
+
+/**
+ * @brief Reads the oldest queued marker. Call it from the main loop.
+ * @param marker Pointer to the structure to fill.
+ * @return false if the queue is empty.
+ */
+bool tone_marker_poll(tone_marker_t *marker);
+
+/**
+ * @brief Reads the dispatch statistics of the markers.
+ * @param stats Pointer to the structure to fill.
+ */
+void tone_marker_get_stats(tone_marker_stats_t *stats);
+
 /**
  * @brief Plays a single tone.
  * @param gen Pointer to the tone generator structure.
@@ -67,7 +523,106 @@ void tone(tonegenerator_t *gen, int freq, uint16_t duration);
  * @param notes Array of notes to play.
  * @param repeat Number of times to repeat the melody.
  */
-void melody(tonegenerator_t *gen, note_t *notes, int8_t repeat);
+void melody(tonegenerator_t *gen, const note_t *notes, int8_t repeat);
+
+/**
+ * @brief Plays a melody precomputed by the C++ melody builder (pwm-tone.hpp).
+ * The tempo is fixed when the table is built, so set_tempo() and TEMPO events have no effect.
+ * @param gen Pointer to the tone generator structure.
+ * @param table Precomputed melody.
+ * @param repeat Number of times to repeat the melody.
+ */
+void melody_table(tonegenerator_t *gen, const melody_table_t *table, int8_t repeat);
+
+/**
+ * @brief Plays a melody stored as compact bytecode, such as generated by tools/melody-compress.py.
+ * Each event is decoded by the scheduler in constant time.
+ * @param gen Pointer to the tone generator structure.
+ * @param code Bytecode, shared by all the melodies and subroutines it contains.
+ * @param size Size of the bytecode (in bytes). Addresses past it end the melody.
+ * @param entry Address of the first opcode of the melody.
+ * @param repeat Number of times to repeat the melody.
+ */
+void melody_code(tonegenerator_t *gen, const uint8_t *code, uint16_t size, uint16_t entry, int8_t repeat);
+
+/**
+ * @brief Plays a melody pulled from a source, in constant RAM.
+ * Events are prefetched into the given ring buffer, which
+ * melody_stream_refill() must then keep filled from the main loop.
+ * @param gen Pointer to the tone generator structure.
+ * @param source Source of the melody events.
+ * @param buffer Ring buffer for prefetched events. Chords that do not fit in it are skipped.
+ * @param size Number of events in the buffer (at least TONE_ARPEGGIO_MAX + 2).
+ * @param repeat Number of times to repeat the melody. Repeats need source->rewind.
+ * @return false if the buffer is too small, in which case nothing is played.
+ */
+bool melody_stream(tonegenerator_t *gen, const melody_source_t *source, note_t *buffer, uint16_t size, int8_t repeat);
+
+/**
+ * @brief Pulls events from the source of a streamed melody into its buffer.
+ * Call it regularly from the main loop, not from interrupt context.
+ * @param gen Pointer to the tone generator structure.
+ * @return Number of events read.
+ */
+uint16_t melody_stream_refill(tonegenerator_t *gen);
+
+/**
+ * @brief Pauses the melody, keeping the time left in the current note.
+ * @param gen Pointer to the tone generator structure.
+ */
+void melody_pause(tonegenerator_t *gen);
+
+/**
+ * @brief Resumes a paused melody where it stopped.
+ * @param gen Pointer to the tone generator structure.
+ */
+void melody_resume(tonegenerator_t *gen);
+
+/**
+ * @brief Builds a seek index for a melody, listing the start time of each note.
+ * Timing follows the tempo of the generator and the rest duration at the time of
+ * the call. Melodies played with melody_table() need melody_index_build_table()
+ * instead. Streamed and bytecode melodies cannot be indexed.
+ * @param gen Pointer to the tone generator structure that will play the melody.
+ * @param notes Array of notes.
+ * @param entries Array to fill, one entry per note, rest or chord.
+ * @param max Number of entries in the array.
+ * @return Number of entries written.
+ */
+uint16_t melody_index_build(tonegenerator_t *gen, const note_t *notes, melody_index_entry_t *entries, uint16_t max);
+
+/**
+ * @brief Builds a seek index for a melody played with melody_table(),
+ * from the durations precomputed in the table. Rests follow the rest duration
+ * at the time of the call.
+ * @param table Precomputed melody.
+ * @param entries Array to fill, one entry per note, rest or chord.
+ * @param max Number of entries in the array.
+ * @return Number of entries written.
+ */
+uint16_t melody_index_build_table(const melody_table_t *table, melody_index_entry_t *entries, uint16_t max);
+
+/**
+ * @brief Moves the melody playing to a point in time, in O(log n).
+ * A paused melody stays paused.
+ * @param gen Pointer to the tone generator structure.
+ * @param entries Index of the melody, from melody_index_build().
+ * @param count Number of entries in the index.
+ * @param time_us Time from the start of the melody (in us).
+ * @return false if the time is past the end of the melody, or no array or table melody is loaded.
+ */
+bool melody_seek(tonegenerator_t *gen, const melody_index_entry_t *entries, uint16_t count, uint32_t time_us);
+
+/**
+ * @brief Moves the melody playing to the start of a note, in O(1).
+ * A paused melody stays paused.
+ * @param gen Pointer to the tone generator structure.
+ * @param entries Index of the melody, from melody_index_build().
+ * @param count Number of entries in the index.
+ * @param note Number of the note, rest or chord (index entry) to move to.
+ * @return false if the note is past the end of the melody, or no array or table melody is loaded.
+ */
+bool melody_seek_note(tonegenerator_t *gen, const melody_index_entry_t *entries, uint16_t count, uint16_t note);
 
 /**
  * @brief Sets the tempo (in bpm).
@@ -75,6 +630,28 @@ void melody(tonegenerator_t *gen, note_t *notes, int8_t repeat);
  */
 void set_tempo(uint16_t bpm);
 
+/**
+ * @brief Sets the tempo of the melodies played by a tone generator.
+ * Takes effect from the next note. TEMPO events in the melody override it.
+ * @param gen Pointer to the tone generator structure.
+ * @param bpm Tempo value (in bpm), 0 to follow set_tempo().
+ */
+void tone_set_tempo(tonegenerator_t *gen, uint16_t bpm);
+
+/**
+ * @brief Sets the interval between arpeggiated chord notes (in ms).
+ * @param interval Arpeggio interval (in ms).
+ */
+void set_arpeggio_interval(uint16_t interval);
+
+/**
+ * @brief Sets the output level (duty cycle) of a tone generator.
+ * Ignored by backends that do not support levels.
+ * @param gen Pointer to the tone generator structure.
+ * @param level Level, in ten-thousandths of a period (0 to 10000).
+ */
+void tone_set_level(tonegenerator_t *gen, uint16_t level);
+
 /**
  * @brief Sets the rest duration (in ms).
  * @param duration Rest duration value (in ms).
@@ -93,6 +670,60 @@ void stop_tone(tonegenerator_t *gen);
  */
 void stop_melody(tonegenerator_t *gen);
 
+/**
+ * @brief Hardware alarm of the dedicated timer pool, or -1 if not enabled.
+ */
+extern int _tone_timer_alarm;
+
+/**
+ * @brief Schedules a callback on the dedicated timer pool.
+ * @param us Delay (in us).
+ * @param callback Function to call.
+ * @param user_data Argument for the callback.
+ * @return Alarm ID, or -1 if the pool is full.
+ */
+alarm_id_t _tone_timer_add(uint64_t us, alarm_callback_t callback, void *user_data);
+
+/**
+ * @brief Cancels a callback scheduled on the dedicated timer pool. Stale and invalid IDs are ignored.
+ * @param id Alarm ID.
+ */
+void _tone_timer_cancel(alarm_id_t id);
+
+/**
+ * @brief Schedules a callback, on the dedicated timer pool if enabled.
+ * Inline, so that with the default alarm pool, each note costs a single call.
+ * @param us Delay (in us).
+ * @param callback Function to call.
+ * @param user_data Argument for the callback.
+ * @return Alarm ID, 0 if the callback has already run, or -1 if no slot is free.
+ */
+static inline alarm_id_t _tone_alarm_add(uint64_t us, alarm_callback_t callback, void *user_data){
+    if (_tone_timer_alarm < 0) return add_alarm_in_us(us, callback, user_data, true);
+    return _tone_timer_add(us, callback, user_data);
+}
+
+/**
+ * @brief Cancels a scheduled callback. Stale and invalid IDs are ignored.
+ * @param id Alarm ID.
+ */
+static inline void _tone_alarm_cancel(alarm_id_t id){
+    if (id <= 0) return;
+    if (_tone_timer_alarm < 0) {
+        cancel_alarm(id);
+    } else {
+        _tone_timer_cancel(id);
+    }
+}
+
+/**
+ * @brief Dispatches a marker to the callback of the generator, or to the queue.
+ * @param gen Pointer to the tone generator structure.
+ * @param id Marker ID.
+ * @param time_us Time the marker was scheduled for (in us since boot).
+ */
+void _tone_marker_dispatch(tonegenerator_t *gen, int16_t id, uint64_t time_us);
+
 /**
  * @brief Sets the PWM frequency.
  * @param gen Pointer to the tone generator structure.
@@ -100,6 +731,73 @@ void stop_melody(tonegenerator_t *gen);
  */
 void _pwm_set_freq(tonegenerator_t *gen, float freq);
 
+/**
+ * @brief Precomputes the PWM divider register value for a frequency.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ * @return Divider register value.
+ */
+uint32_t _pwm_prepare_freq(tonegenerator_t *gen, float freq);
+
+/**
+ * @brief Writes a precomputed PWM divider register value.
+ * @param gen Pointer to the tone generator structure.
+ * @param value Divider register value.
+ */
+void _pwm_apply_freq(tonegenerator_t *gen, uint32_t value);
+
+/**
+ * @brief Sets the PWM level.
+ * @param gen Pointer to the tone generator structure.
+ * @param level Level, in ten-thousandths of a period.
+ */
+void _pwm_set_level(tonegenerator_t *gen, uint16_t level);
+
+/**
+ * @brief Starts or stops the PWM slice.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+void _pwm_set_enabled(tonegenerator_t *gen, bool enabled);
+
+#if !PWM_TONE_PWM_ONLY
+/**
+ * @brief Sets the PIO square wave frequency.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ */
+void _pio_set_freq(tonegenerator_t *gen, float freq);
+
+/**
+ * @brief Precomputes the PIO half period for a frequency.
+ * @param gen Pointer to the tone generator structure.
+ * @param freq Frequency value (in Hz).
+ * @return Half period (in state machine cycles).
+ */
+uint32_t _pio_prepare_freq(tonegenerator_t *gen, float freq);
+
+/**
+ * @brief Sends a precomputed half period to the state machine.
+ * @param gen Pointer to the tone generator structure.
+ * @param value Half period (in state machine cycles).
+ */
+void _pio_apply_freq(tonegenerator_t *gen, uint32_t value);
+
+/**
+ * @brief Starts or stops the noise output.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+void _noise_set_enabled(tonegenerator_t *gen, bool enabled);
+
+/**
+ * @brief Starts or stops the PIO square wave.
+ * @param gen Pointer to the tone generator structure.
+ * @param enabled Whether the output should be running.
+ */
+void _pio_set_enabled(tonegenerator_t *gen, bool enabled);
+#endif
+
 /**
  * @brief Turns on the PWM tone.
  * @param gen Pointer to the tone generator structure.
@@ -113,37 +811,46 @@ void _tone_pwm_on(tonegenerator_t *gen, int freq);
  */
 void _melody_step(tonegenerator_t *gen);
 
+/**
+ * @brief Turns on the tone at a precomputed backend value.
+ * @param gen Pointer to the tone generator structure.
+ * @param value Backend value, as returned by prepare_freq.
+ */
+void _tone_pwm_on_value(tonegenerator_t *gen, uint32_t value);
+
 /**
  * @brief Plays a single note in the melody.
  * @param gen Pointer to the tone generator structure.
  * @param freq Frequency of the note (in Hz).
- * @param duration Duration of the note (in ms).
+ * @param value Precomputed backend value for the frequency, or 0 to compute it.
+ * @param duration Duration of the note (in us).
  */
-void _melody_tone(tonegenerator_t *gen, int freq, uint16_t duration);
+void _melody_tone(tonegenerator_t *gen, int freq, uint32_t value, uint32_t duration);
 
 /**
- * @brief Callback for the the tone playback.
- * @param id Alarm ID.
- * @param user_data Pointer to the tone generator structure.
- * @return 0 on success.
+ * @brief Decodes the next event of a melody stored as bytecode.
+ * @param code Bytecode.
+ * @param state Decoder state, moved past the event.
+ * @param note Pointer to the event to fill. Invalid bytecode decodes as MELODY_END.
  */
-static int64_t _tone_complete(alarm_id_t id, void *user_data);
+void _melody_code_next(const uint8_t *code, melody_code_state_t *state, note_t *note);
 
 /**
- * @brief Callback for the melody note playback.
- * @param id Alarm ID.
- * @param user_data Pointer to the tone generator structure.
- * @return 0 on success.
+ * @brief Starts a new tempo segment in the melody.
+ * @param mel Pointer to the melody.
+ * @param bpm New tempo (in bpm).
+ * @param notes Number of notes over which the tempo moves to the new value (0 for immediately).
  */
-static int64_t _melody_note_complete(alarm_id_t id, void *user_data);
+void _melody_tempo(melody_t *mel, uint16_t bpm, uint8_t notes);
 
 /**
- * @brief Callback for the rest period.
- * @param id Alarm ID.
- * @param user_data Pointer to the tone generator structure.
- * @return 0 on success.
+ * @brief Plays a chord as a fast arpeggio.
+ * @param gen Pointer to the tone generator structure.
+ * @param notes Notes making up the chord.
+ * @param count Number of notes in the chord.
+ * @param duration Duration of the chord (in us).
  */
-static int64_t _rest_complete(alarm_id_t id, void *user_data);
+void _melody_chord(tonegenerator_t *gen, note_t *notes, uint8_t count, uint32_t duration);
 
 #ifdef __cplusplus
 }
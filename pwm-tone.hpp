@@ -0,0 +1,213 @@
+/**
+ * @file pwm-tone.hpp
+ * @brief Compile-time melody builder for the PWM Tone generation library (C++17).
+ * Checks melodies for termination and value ranges while compiling, and
+ * precomputes the duration and PWM divider value of every event into tables
+ * that are stored in flash and played with melody_table().
+ * @author Turi Scandurra
+ * @see https://turiscandurra.com/circuits
+ */
+
+#ifndef PWM_TONE_HPP
+#define PWM_TONE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pwm-tone.h"
+
+#if __cplusplus < 201703L
+#error "pwm-tone.hpp requires C++17"
+#endif
+
+/**
+ * @def PWM_TONE_CLOCK_HZ
+ * @brief System clock the PWM divider values are precomputed for (in Hz).
+ * melody_table() falls back to computing them if the actual clock differs.
+ */
+#ifndef PWM_TONE_CLOCK_HZ
+#ifdef SYS_CLK_KHZ
+#define PWM_TONE_CLOCK_HZ (SYS_CLK_KHZ * 1000u)
+#else
+#define PWM_TONE_CLOCK_HZ 125000000u
+#endif
+#endif
+
+namespace pwm_tone {
+
+/**
+ * @brief Compile-time errors. These functions are not constexpr, so reaching
+ * one while building a melody stops the compilation, with its name in the message.
+ */
+inline void error_missing_melody_end() {}
+inline void error_events_after_melody_end() {}
+inline void error_frequency_out_of_range() {}
+inline void error_measure_zero() {}
+inline void error_chord_size() {}
+inline void error_chord_past_melody_end() {}
+inline void error_tempo_zero() {}
+inline void error_tempo_ramp_negative() {}
+
+/**
+ * @brief Melody with precomputed tables, as returned by build().
+ * @tparam N Number of events, including MELODY_END.
+ */
+template <size_t N>
+struct melody_data {
+    note_t notes[N]; /**< Array of notes, terminated by MELODY_END. */
+    uint32_t duration_us[N]; /**< Duration of each note, rest and chord (in us). */
+    uint32_t freq_values[N]; /**< PWM divider register value of each note (0 for other events). */
+    uint32_t clock_hz; /**< System clock the divider values were computed for (in Hz). */
+    uint32_t length_us; /**< Length of the melody, without the rests between notes (in us). */
+
+    /**
+     * @brief Describes the tables for melody_table().
+     * @return Table descriptor.
+     */
+    constexpr melody_table_t table() const {
+        return {notes, duration_us, freq_values, clock_hz};
+    }
+};
+
+/**
+ * @brief Whether a frequency is in the range played by the library.
+ * @param freq Frequency (in Hz).
+ */
+constexpr bool is_pitch(float freq) {
+    return freq >= (float) NOTE_G1 && freq <= (float) NOTE_FS9;
+}
+
+/**
+ * @brief Computes the PWM divider register value for a frequency,
+ * exactly as _pwm_prepare_freq() does at run time.
+ * @param clock_hz System clock (in Hz).
+ * @param freq Frequency (in Hz).
+ * @return Divider register value.
+ */
+constexpr uint32_t pwm_divider(uint32_t clock_hz, float freq) {
+    float hz = (float)(int) freq; // Notes are played at whole Hz
+    float divider = (float) clock_hz / (hz * 10000.0f);
+    uint32_t value = (uint32_t)(divider * 16.0f);
+    return value > 0xFFF ? 0xFFF : value;
+}
+
+/**
+ * @brief Checks one event, and the chord notes that follow it.
+ * @param notes Array of notes.
+ * @param count Number of events in the array.
+ * @param i Position of the event.
+ * @return Number of events checked.
+ */
+constexpr size_t check_event(const note_t *notes, size_t count, size_t i) {
+    const note_t &note = notes[i];
+    if (note.freq == (float) MELODY_END) {
+        if (i != count - 1) error_events_after_melody_end();
+        return 1;
+    }
+    if (note.freq == (float) CHORD) {
+        if (note.measure < 1 || note.measure > TONE_ARPEGGIO_MAX) error_chord_size();
+        if (i + note.measure >= count) {
+            error_chord_past_melody_end();
+            return count - i;
+        }
+        for (size_t j = i + 1; j <= i + note.measure; j++) {
+            if (!is_pitch(notes[j].freq)) error_frequency_out_of_range();
+        }
+        if (notes[i + 1].measure == 0) error_measure_zero();
+        return note.measure + 1;
+    }
+    if (note.freq == (float) TEMPO) {
+        if (note.arg <= 0) error_tempo_zero();
+        if (note.measure < 0) error_tempo_ramp_negative();
+        return 1;
+    }
+    if (note.freq == (float) MARKER) return 1;
+    if (note.freq != (float) REST && !is_pitch(note.freq)) error_frequency_out_of_range();
+    if (note.measure == 0) error_measure_zero();
+    return 1;
+}
+
+/**
+ * @brief Checks a melody written as a constexpr array, for use in static_assert().
+ * @param notes Array of notes, which must end with MELODY_END.
+ * @return true if the melody is valid (otherwise, the compilation stops).
+ */
+template <size_t N>
+constexpr bool validate(const note_t (&notes)[N]) {
+    static_assert(N <= UINT16_MAX, "melody too long");
+    if (notes[N - 1].freq != (float) MELODY_END) error_missing_melody_end();
+    for (size_t i = 0; i < N; i += check_event(notes, N, i)) {}
+    return true;
+}
+
+/**
+ * @brief Builds a melody at compile time, at a fixed tempo.
+ * The terminating MELODY_END is added if missing. Tempo changes and ramps
+ * are applied as the sequencer would, so durations match melody() exactly.
+ * @code
+ * static constexpr auto intro = pwm_tone::build<140>({
+ *     {NOTE_C5, 8}, {NOTE_E5, 8}, MARKER_AT(1), {NOTE_G5, 4},
+ * });
+ * melody_table_t table = intro.table();
+ * melody_table(&generator, &table, 0);
+ * @endcode
+ * @tparam Bpm Tempo (in bpm).
+ * @tparam ClockHz System clock the PWM divider values are computed for (in Hz).
+ * @param notes Notes of the melody.
+ * @return Melody with its precomputed tables.
+ */
+template <uint16_t Bpm, uint32_t ClockHz = PWM_TONE_CLOCK_HZ, size_t N>
+constexpr melody_data<N + 1> build(const note_t (&notes)[N]) {
+    static_assert(Bpm > 0, "tempo must be positive");
+    static_assert(N + 1 <= UINT16_MAX, "melody too long");
+
+    melody_data<N + 1> m{};
+    size_t count = N;
+    for (size_t i = 0; i < N; i++) m.notes[i] = notes[i];
+    if (notes[N - 1].freq != (float) MELODY_END) count = N + 1;
+    m.notes[N] = {(float) MELODY_END, 0, 0};
+    m.clock_hz = ClockHz;
+
+    // Same tempo arithmetic as _melody_tempo() and _note_duration()
+    uint16_t bpm = Bpm;
+    uint32_t whole_note_us = (60000000u * 4) / bpm;
+    int32_t ramp_step_us = 0;
+    uint8_t ramp_notes = 0;
+
+    for (size_t i = 0; i < count; ) {
+        size_t events = check_event(m.notes, count, i);
+        const note_t &note = m.notes[i];
+        if (note.freq == (float) TEMPO) {
+            uint32_t target_us = (60000000u * 4) / note.arg;
+            if (note.measure > 0) {
+                ramp_step_us = ((int32_t) target_us - (int32_t) whole_note_us) / note.measure;
+                ramp_notes = note.measure;
+            } else {
+                whole_note_us = target_us;
+                ramp_notes = 0;
+            }
+            bpm = note.arg;
+        } else if (note.freq != (float) MELODY_END && note.freq != (float) MARKER) {
+            int8_t measure = note.freq == (float) CHORD ? m.notes[i + 1].measure : note.measure;
+            if (ramp_notes > 0) {
+                if (--ramp_notes == 0) {
+                    whole_note_us = (60000000u * 4) / bpm;
+                } else {
+                    whole_note_us += ramp_step_us;
+                }
+            }
+            uint32_t duration = whole_note_us / (measure < 0 ? -measure : measure);
+            if (measure < 0) duration += duration / 2;
+            m.duration_us[i] = duration;
+            m.length_us += duration;
+            if (note.freq != (float) CHORD && note.freq != (float) REST) {
+                m.freq_values[i] = pwm_divider(ClockHz, note.freq);
+            }
+        }
+        i += events;
+    }
+    return m;
+}
+
+} // namespace pwm_tone
+
+#endif // PWM_TONE_HPP
@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+"""
+Melody compressor for the PWM Tone generation library.
+
+Reads the note_t melodies of a header such as melodies.h and writes them as
+compact bytecode, to be played with melody_code(). Runs of repeated phrases
+become repeated blocks, and phrases found more than once, in the same melody
+or in different ones, become subroutines shared by all the melodies.
+The bytecode is decoded again and compared with the original events before
+it is written, and the flash used before and after is reported.
+
+Usage:
+    tools/melody-compress.py [melodies.h] [-o melodies-code.h]
+
+Author: Turi Scandurra
+See: https://turiscandurra.com/circuits
+"""
+
+import argparse
+import os
+import re
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# Opcodes, as defined in pwm-tone.h
+OP_END, OP_REST, OP_FREQ, OP_CHORD, OP_TEMPO, OP_MARKER, \
+    OP_REPEAT, OP_LOOP, OP_CALL, OP_RET = range(0x80, 0x8A)
+
+# Must match MELODY_CODE_DEPTH. Repeated blocks are nested at most twice,
+# and calls are only made from the top level of a melody, to stay within it.
+CODE_DEPTH = 4
+MAX_REPEAT_NESTING = 2
+
+# Special frequencies, as defined in pitches.h
+MELODY_END, REST, CHORD, TEMPO, MARKER = -1.0, 0.0, -2.0, -3.0, -4.0
+
+NOTE_T_SIZE = 8  # sizeof(note_t)
+
+
+def read_pitches(path):
+    """Returns the pitch of each NOTE_ macro, and the macros in MIDI order."""
+    text = open(path).read()
+    pitches = {name: float(value) for name, value in
+               re.findall(r"#define\s+(NOTE_\w+)\s+([\d.]+)", text)}
+    table = re.search(r"midi_to_pitch\[128\]\s*=\s*\{(.*?)\};", text, re.S).group(1)
+    midi = {name: number for number, name in enumerate(re.findall(r"NOTE_\w+", table))}
+    return pitches, midi
+
+
+def read_melodies(path, pitches):
+    """Returns the melodies of a header, as lists of (freq, measure, arg, name)."""
+    text = open(path).read()
+    text = re.sub(r"//[^\n]*|/\*.*?\*/", "", text, flags=re.S)
+    specials = {"MELODY_END": MELODY_END, "REST": REST, "CHORD": CHORD,
+                "TEMPO": TEMPO, "MARKER": MARKER}
+
+    def value(token):
+        token = token.strip()
+        if token in specials:
+            return specials[token], None
+        if token in pitches:
+            return pitches[token], token
+        return float(token), None
+
+    melodies = {}
+    for name, body in re.findall(r"note_t\s+(\w+)\s*\[\s*\]\s*=\s*\{(.*?)\}\s*;", text, re.S):
+        events = []
+        for macro, args, entry in re.findall(
+                r"(TEMPO_CHANGE|TEMPO_RAMP|MARKER_AT)\s*\(([^)]*)\)|\{([^{}]*)\}", body):
+            if macro:
+                args = [int(a, 0) for a in args.split(",")]
+                if macro == "TEMPO_CHANGE":
+                    events.append((TEMPO, 0, args[0], None))
+                elif macro == "TEMPO_RAMP":
+                    events.append((TEMPO, args[1], args[0], None))
+                else:
+                    events.append((MARKER, 0, args[0], None))
+                continue
+            fields = [f for f in entry.split(",") if f.strip()]
+            freq, pitch = value(fields[0])
+            measure = int(fields[1], 0) if len(fields) > 1 else 0
+            arg = int(fields[2], 0) if len(fields) > 2 else 0
+            events.append((freq, measure, arg, pitch))
+        melodies[name] = events
+    return melodies
+
+
+def u16(value):
+    return [value & 0xFF, (value >> 8) & 0xFF]
+
+
+def int8(value):
+    """Stores a measure as the int8_t field of note_t would (128 becomes -128)."""
+    return value & 0xFF
+
+
+def encode_event(event, midi):
+    freq, measure, arg, pitch = event
+    if freq == MELODY_END:
+        return (OP_END,)
+    if freq == REST:
+        return (OP_REST, int8(measure))
+    if freq == CHORD:
+        return (OP_CHORD, int8(measure))
+    if freq == TEMPO:
+        return (OP_TEMPO, int8(measure)) + tuple(u16(arg))
+    if freq == MARKER:
+        return (OP_MARKER,) + tuple(u16(arg))
+    if pitch in midi:
+        return (midi[pitch], int8(measure))
+    return (OP_FREQ,) + tuple(u16(int(freq))) + (int8(measure),)
+
+
+def tokenize(events, midi):
+    """Encodes the events, keeping each chord and its notes in a single token."""
+    tokens = []
+    i = 0
+    while i < len(events):
+        count = events[i][1] + 1 if events[i][0] == CHORD else 1
+        code = ()
+        for event in events[i:i + count]:
+            code += encode_event(event, midi)
+        tokens.append(("E", code))
+        i += count
+    return tokens
+
+
+def size(token):
+    kind = token[0]
+    if kind == "E":
+        return len(token[1])
+    if kind == "R":
+        return 2 + sum(size(t) for t in token[2]) + 1
+    return 3  # Call
+
+
+def fold_repeats(tokens, nesting=0):
+    """Replaces runs of a repeated phrase with a repeated block, greedily."""
+    if nesting == MAX_REPEAT_NESTING:
+        return tokens
+    out = []
+    i = 0
+    while i < len(tokens):
+        best = None  # (saving, length, count)
+        for length in range(1, (len(tokens) - i) // 2 + 1):
+            body = tokens[i:i + length]
+            if any(t[0] == "E" and t[1][0] == OP_END for t in body):
+                break
+            count = 1
+            while count < 255 and tokens[i + count * length:i + (count + 1) * length] == body:
+                count += 1
+            if count > 1:
+                body_size = sum(size(t) for t in body)
+                saving = body_size * count - (body_size + 3)
+                if saving > 0 and (best is None or saving > best[0]):
+                    best = (saving, length, count)
+        if best:
+            _, length, count = best
+            body = fold_repeats(tokens[i:i + length], nesting + 1)
+            out.append(("R", count, tuple(body)))
+            i += length * count
+        else:
+            out.append(tokens[i])
+            i += 1
+    return out
+
+
+def find_occurrences(sequence, phrase):
+    """Returns the start of the non-overlapping occurrences of a phrase."""
+    found = []
+    i = 0
+    while i <= len(sequence) - len(phrase):
+        if tuple(sequence[i:i + len(phrase)]) == phrase:
+            found.append(i)
+            i += len(phrase)
+        else:
+            i += 1
+    return found
+
+
+def extract_subroutines(melodies, max_length=32):
+    """Moves the phrase that saves the most bytes to a subroutine, until none saves any."""
+    subroutines = []
+    while True:
+        candidates = set()
+        for tokens in melodies.values():
+            for length in range(2, max_length + 1):
+                for i in range(len(tokens) - length + 1):
+                    phrase = tuple(tokens[i:i + length])
+                    if all(t[0] != "C" and not (t[0] == "E" and t[1][0] == OP_END) for t in phrase):
+                        candidates.add(phrase)
+        best = None  # (saving, phrase)
+        for phrase in candidates:
+            count = sum(len(find_occurrences(t, phrase)) for t in melodies.values())
+            phrase_size = sum(size(t) for t in phrase)
+            saving = count * phrase_size - (count * 3 + phrase_size + 1)
+            if saving > 0 and (best is None or saving > best[0] or
+                               (saving == best[0] and phrase < best[1])):
+                best = (saving, phrase)
+        if best is None:
+            return subroutines
+        phrase = best[1]
+        call = ("C", len(subroutines))
+        subroutines.append(phrase)
+        for name, tokens in melodies.items():
+            for start in reversed(find_occurrences(tokens, phrase)):
+                tokens[start:start + len(phrase)] = [call]
+
+
+def emit(tokens, addresses):
+    code = []
+    for token in tokens:
+        if token[0] == "E":
+            code += token[1]
+        elif token[0] == "R":
+            code += [OP_REPEAT, token[1]] + emit(token[2], addresses) + [OP_LOOP]
+        else:
+            code += [OP_CALL] + u16(addresses[token[1]])
+    return code
+
+
+def link(melodies, subroutines):
+    """Lays out the melodies, then the subroutines. Returns the code and entry points."""
+    entries = {}
+    address = 0
+    for name, tokens in melodies.items():
+        entries[name] = address
+        address += sum(size(t) for t in tokens)
+    sub_addresses = []
+    for phrase in subroutines:
+        sub_addresses.append(address)
+        address += sum(size(t) for t in phrase) + 1
+    code = []
+    for tokens in melodies.values():
+        code += emit(tokens, sub_addresses)
+    for phrase in subroutines:
+        code += emit(phrase, sub_addresses) + [OP_RET]
+    if len(code) > 0xFFFF:
+        sys.exit("error: bytecode larger than 64 KiB")
+    return code, entries
+
+
+def decode(code, entry, midi_pitches):
+    """Decodes a melody the way _melody_code_next() does, for verification."""
+    events = []
+    pc = entry
+    stack = []  # [count, address]
+    while True:
+        op = code[pc]
+        if op < 0x80:
+            events.append((midi_pitches[op], code[pc + 1], 0))
+            pc += 2
+        elif op == OP_REST:
+            events.append((REST, code[pc + 1], 0))
+            pc += 2
+        elif op == OP_FREQ:
+            events.append((float(code[pc + 1] | code[pc + 2] << 8), code[pc + 3], 0))
+            pc += 4
+        elif op == OP_CHORD:
+            events.append((CHORD, code[pc + 1], 0))
+            pc += 2
+        elif op == OP_TEMPO:
+            events.append((TEMPO, code[pc + 1], code[pc + 2] | code[pc + 3] << 8))
+            pc += 4
+        elif op == OP_MARKER:
+            events.append((MARKER, 0, code[pc + 1] | code[pc + 2] << 8))
+            pc += 3
+        elif op == OP_REPEAT:
+            stack.append([code[pc + 1], pc + 2])
+            pc += 2
+        elif op == OP_LOOP:
+            stack[-1][0] -= 1
+            if stack[-1][0] > 0:
+                pc = stack[-1][1]
+            else:
+                stack.pop()
+                pc += 1
+        elif op == OP_CALL:
+            stack.append([0, pc + 3])
+            pc = code[pc + 1] | code[pc + 2] << 8
+        elif op == OP_RET:
+            pc = stack.pop()[1]
+        else:
+            events.append((MELODY_END, 0, 0))
+            return events
+        if len(stack) > CODE_DEPTH:
+            sys.exit("error: bytecode nested deeper than MELODY_CODE_DEPTH")
+
+
+def expected(events, midi, midi_pitches):
+    """The events as the decoder should return them."""
+    out = []
+    for freq, measure, arg, pitch in events:
+        if pitch in midi:
+            freq = midi_pitches[midi[pitch]]
+        elif freq > 0:
+            freq = float(int(freq))
+        if freq not in (TEMPO, MARKER):
+            arg = 0
+        out.append((freq, int8(measure), arg & 0xFFFF if freq in (TEMPO, MARKER) else 0))
+        if freq == MELODY_END:
+            break
+    return out
+
+
+def write_header(path, source, code, entries):
+    lines = [
+        "/**",
+        " * @file %s" % os.path.basename(path),
+        " * @brief Predefined melodies as compact bytecode, for melody_code().",
+        " * Generated from %s by tools/melody-compress.py. Do not edit." % os.path.basename(source),
+        " * @author Turi Scandurra",
+        " * @see https://turiscandurra.com/circuits",
+        " */",
+        "",
+        "#ifndef TONE_MELODIES_CODE_H",
+        "#define TONE_MELODIES_CODE_H",
+        "",
+        "/**",
+        " * @brief Address of each melody in MELODY_CODE.",
+        " */",
+    ]
+    for name, address in entries.items():
+        lines.append("#define CODE_%-20s %d" % (name, address))
+    lines += [
+        "",
+        "/**",
+        " * @brief Bytecode of all the melodies, and of the subroutines they share.",
+        " */",
+        "static const uint8_t MELODY_CODE[%d] = {" % len(code),
+    ]
+    for i in range(0, len(code), 16):
+        lines.append("    " + " ".join("0x%02X," % b for b in code[i:i + 16]))
+    lines += ["};", "", "#endif // TONE_MELODIES_CODE_H", ""]
+    open(path, "w").write("\n".join(lines))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compresses note_t melodies into bytecode for melody_code().")
+    parser.add_argument("melodies", nargs="?", default=os.path.join(ROOT, "melodies.h"))
+    parser.add_argument("-o", "--output", default=os.path.join(ROOT, "melodies-code.h"))
+    parser.add_argument("--pitches", default=os.path.join(ROOT, "pitches.h"))
+    args = parser.parse_args()
+
+    pitches, midi = read_pitches(args.pitches)
+    midi_pitches = [0.0] * 128
+    for name, number in midi.items():
+        midi_pitches[number] = pitches[name]
+    originals = read_melodies(args.melodies, pitches)
+
+    melodies = {name: fold_repeats(tokenize(events, midi)) for name, events in originals.items()}
+    subroutines = extract_subroutines(melodies)
+    code, entries = link(melodies, subroutines)
+
+    for name, events in originals.items():
+        if decode(code, entries[name], midi_pitches) != expected(events, midi, midi_pitches):
+            sys.exit("error: %s does not decode to the original events" % name)
+
+    write_header(args.output, args.melodies, code, entries)
+
+    # Sizes in bytes: as note_t arrays, as bytecode without repeats and
+    # subroutines, and as the final bytecode
+    print("%-16s %8s %8s %8s %8s" % ("melody", "events", "note_t", "flat", "code"))
+    total_notes = total_flat = 0
+    for name, events in originals.items():
+        notes = len(events) * NOTE_T_SIZE
+        flat = sum(size(t) for t in tokenize(events, midi))
+        body = sum(size(t) for t in melodies[name])
+        total_notes += notes
+        total_flat += flat
+        print("%-16s %8d %8d %8d %8d" % (name, len(events), notes, flat, body))
+    shared = len(code) - sum(sum(size(t) for t in m) for m in melodies.values())
+    print("%-16s %8d %8s %8s %8d" % ("(subroutines)", len(subroutines), "", "", shared))
+    print("%-16s %8s %8d %8d %8d" % ("total", "", total_notes, total_flat, len(code)))
+
+
+if __name__ == "__main__":
+    main()